@@ -44,7 +44,14 @@
 #include <linux/firmware.h>
 #include <linux/fs.h>
 #include <linux/version.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/of_platform.h>
+#include <linux/devfreq.h>
+#include <linux/pm_opp.h>
+#include <linux/thermal.h>
 #include "fpga-region-interface.h"
+#include "fpga-region-clock.h"
 
 /**
  * DOC: fpga-region-clock constants 
@@ -64,11 +71,24 @@ MODULE_LICENSE("Dual BSD/GPL");
 #define USE_DEV_GROUPS      0
 #endif
 
+#if     (IS_ENABLED(CONFIG_PM_DEVFREQ) && IS_ENABLED(CONFIG_PM_OPP))
+#define USE_DEVFREQ         1
+#else
+#define USE_DEVFREQ         0
+#endif
+
+#if     (IS_ENABLED(CONFIG_THERMAL_OF))
+#define USE_THERMAL         1
+#else
+#define USE_THERMAL         0
+#endif
+
 /**
  * DOC: fpga-region-clock static variables
  *
  * * info_enable    - fpga-region-clock install/uninstall infomation enable.
  * * debug_print    - fpga-region-clock debug print enable.
+ * * hitless_detect - fpga-region-clock hitless rate change detection enable.
  */
 
 /**
@@ -85,6 +105,16 @@ static int            debug_print = 0;
 module_param(         debug_print , int, S_IRUGO);
 MODULE_PARM_DESC(     debug_print , DRIVER_NAME " debug print enable");
 
+/**
+ * hitless_detect   - fpga-region-clock hitless rate change detection enable.
+ *
+ * Change the rate of clocks without the hitless-rate-change property
+ * without gating them too, if their flags allow it.
+ */
+static int            hitless_detect = 0;
+module_param(         hitless_detect , int, S_IRUGO);
+MODULE_PARM_DESC(     hitless_detect , DRIVER_NAME " hitless rate change detection enable");
+
 #define DEV_DBG(dev, fmt, ...) {\
     if (debug_print){dev_info(dev, fmt, ##__VA_ARGS__);} \
     else            {dev_dbg (dev, fmt, ##__VA_ARGS__);} \
@@ -191,6 +221,25 @@ static void of_get_fclk_state(
     DEV_DBG(dev, "get %s done.\n", resclk_name);
 }
 
+/**
+ * struct fclk_plan - fclk state transition plan.
+ *
+ * The transition to a fclk state resolved by __fclk_make_plan(): the
+ * clock in the chain whose parent becomes the resource clock, the
+ * rounded rate, and whether the clock can keep running meanwhile.
+ */
+struct fclk_plan {
+    bool                 valid;
+    bool                 hitless;
+    bool                 rate_valid;
+    unsigned long        rate;
+    unsigned long        round_rate;
+    bool                 resclk_valid;
+    unsigned long        resclk;
+    struct clk*          resclk_child;
+    struct clk*          resclk_clk;
+};
+
 /**
  * DOC: fclk device data structure
  *
@@ -199,9 +248,19 @@ static void of_get_fclk_state(
  */
 /**
  * struct fclk_device_data - fclk device data structure.
+ *
+ * @lock serializes the changes of the clock, of the region, insert and
+ * remove states and of the region plan by the FPGA region, by sysfs, by
+ * devfreq and by the thermal framework.
+ *
+ * @probe_rate is the rate of the clock at probe, the normal rate of a
+ * clock without region rate.  It does not change while the clock is
+ * lowered by devfreq or by cooling.  The ceiling of a cooling state is computed from the normal rate when it
+ * is applied, see __fclk_rate_ceiling().
  */
 struct fclk_device_data {
     struct device*       device;
+    struct mutex         lock;
     struct clk*          clk;
     struct clk**         resource_clks;
     int                  resource_clks_size;
@@ -210,7 +269,25 @@ struct fclk_device_data {
     struct fclk_state    insert;
     struct fclk_state    remove;
     bool                 bridge_enable;
+    bool                 hitless_rate_change;
     struct fclk_state    region;
+    struct fclk_plan     region_plan;
+    unsigned long        elided_transitions;
+    unsigned long        probe_rate;
+#if (USE_THERMAL == 1)
+    struct thermal_cooling_device*           cooling;
+    unsigned long                            cooling_state;
+    unsigned long                            cooling_steps;
+#endif
+#if (USE_DEVFREQ == 1)
+    struct devfreq*                          devfreq;
+    struct devfreq_dev_profile               devfreq_profile;
+    unsigned long*                           devfreq_rates;
+    int                                      devfreq_rates_size;
+    unsigned long                            devfreq_max_rate;
+    const struct fpga_region_clock_load_ops* load_ops;
+    void*                                    load_data;
+#endif
 };
 
 /**
@@ -220,8 +297,15 @@ struct fclk_device_data {
  *
  * * __fclk_set_enable()       - enable/disable clock.
  * * __fclk_set_rate()         - set clock rate.
+ * * __fclk_find_resource()    - find where a resource clock is connected.
+ * * __fclk_hitless()          - check if the clock can be changed without gating.
+ * * __fclk_make_plan()        - resolve the transition to a clock state.
+ * * __fclk_exec_plan()        - change clock state by a plan.
  * * __fclk_change_state()     - change clock state.
- * * __fclk_change_resource()  - change resource clock.
+ * * __fclk_normal_rate()      - the rate of the clock while it is not limited.
+ * * __fclk_rate_ceiling()     - limit a rate to the region rate and the thermal limit.
+ * * __fclk_plan_region_state() - make the plan of a region state.
+ * * __fclk_plan_region()      - make the plan of the region state.
  *
  */
 /**
@@ -258,16 +342,17 @@ static int __fclk_set_enable(struct fclk_device_data* this, bool enable)
  *
  * @this:       Pointer to the fclk device data.
  * @rate:       rate.
+ * @round_rate: rate rounded by clk_round_rate() in advance, or 0.
  * Return:      Success(=0) or error status(<0).
  *
  */
-static int __fclk_set_rate(struct fclk_device_data* this, unsigned long rate)
+static int __fclk_set_rate(struct fclk_device_data* this, unsigned long rate, unsigned long round_rate)
 {
     int           status;
-    unsigned long round_rate;
 
-    round_rate = clk_round_rate(this->clk, rate);
-    status     = clk_set_rate(this->clk, round_rate);
+    if (round_rate == 0)
+        round_rate = clk_round_rate(this->clk, rate);
+    status = clk_set_rate(this->clk, round_rate);
 
     if (status)
         dev_err(this->device, "set_rate(%lu=>%lu) failed." , rate, round_rate);
@@ -278,85 +363,321 @@ static int __fclk_set_rate(struct fclk_device_data* this, unsigned long rate)
 }
 
 /**
- * __fclk_change_resource() - change resource clock.
+ * __fclk_find_resource() - find where a resource clock is connected.
  *
- * @this:       Pointer to the fclk device data.
- * @index:	index of resource_clks.
- * Return:      Success(=0) or error status(<0).
+ * @this:         Pointer to the fclk device data.
+ * @index:        index of resource_clks.
+ * @child:        set to the clock in the chain of the clock whose parent
+ *                the resource clock can be, or NULL if there are no
+ *                resource clocks.
+ * @resource_clk: set to the resource clock.
+ * Return:        Success(=0) or error status(<0).
  *
  */
-static int __fclk_change_resource(struct fclk_device_data* this, int index)
+static int __fclk_find_resource(struct fclk_device_data* this, int index, struct clk** child, struct clk** resource_clk)
 {
-    struct device* dev = this-> device;
+    struct device* dev = this->device;
+    struct clk*    curr_clk;
 
-    if ((this->resource_clks == NULL) && index == 0) {
-        this->resource_clk_id = index;
+    *child        = NULL;
+    *resource_clk = NULL;
+
+    if ((this->resource_clks == NULL) && (index == 0))
         return 0;
+
+    if ((this->resource_clks == NULL) || (index < 0) || (index >= this->resource_clks_size))
+        return -EINVAL;
+
+    *resource_clk = this->resource_clks[index];
+    for (curr_clk = this->clk; !IS_ERR_OR_NULL(curr_clk); curr_clk = clk_get_parent(curr_clk)) {
+        if (clk_has_parent(curr_clk, *resource_clk) == true) {
+            *child = curr_clk;
+            return 0;
+        }
     }
+    dev_err(dev, "%s is not resource clock of %s.\n", __clk_get_name(*resource_clk), __clk_get_name(this->clk));
+    return -EINVAL;
+}
 
-    if ((this->resource_clks != NULL) && (index >= 0) && (index < this->resource_clks_size)) {
-        struct clk*    resource_clk       = this->resource_clks[index];
-        int            set_parent_status  = 0;
-        bool           found_resource_clk = false;
-        struct clk*    curr_clk           = this->clk;
-        while (!IS_ERR_OR_NULL(curr_clk)) {
-            if (clk_has_parent(curr_clk, resource_clk) == true) {
-                found_resource_clk = true;
-                set_parent_status  = clk_set_parent(curr_clk, resource_clk);
+/**
+ * __fclk_hitless() - check if the clock can be changed without gating.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @plan:       plan whose transition is checked.
+ * Return:      true if the rate and the resource clock can be changed
+ *              while the clock is running.
+ *
+ * A clock is changed without gating if the hitless-rate-change property
+ * declares that it does not glitch, or hitless_detect is set, and no
+ * clock that the change reaches has CLK_SET_RATE_GATE or
+ * CLK_SET_PARENT_GATE.
+ */
+static bool __fclk_hitless(struct fclk_device_data* this, struct fclk_plan* plan)
+{
+    struct clk*   curr_clk;
+    unsigned long flags;
+
+    if ((this->hitless_rate_change == false) && (hitless_detect == 0))
+        return false;
+
+    if (plan->rate_valid == true) {
+        for (curr_clk = this->clk; !IS_ERR_OR_NULL(curr_clk); curr_clk = clk_get_parent(curr_clk)) {
+            flags = __clk_get_flags(curr_clk);
+            if (flags & CLK_SET_RATE_GATE)
+                return false;
+            if (!(flags & CLK_SET_RATE_PARENT))
                 break;
-            }
-            curr_clk = clk_get_parent(curr_clk);
         }
-        if (set_parent_status != 0) {
-            dev_err(dev, "clk_set_parent(%s, %s) failed.\n" , __clk_get_name(curr_clk), __clk_get_name(resource_clk));
-            return set_parent_status;
-        }
-        if (found_resource_clk == false) {
-            dev_err(dev, "%s is not resource clock of %s.\n", __clk_get_name(resource_clk), __clk_get_name(this->clk));
-            return -EINVAL;
-        }
-        this->resource_clk_id = index;
-        return 0;
     }
-    return -EINVAL;
+    if ((plan->resclk_valid == true) && (plan->resclk_child != NULL)) {
+        if (__clk_get_flags(plan->resclk_child) & CLK_SET_PARENT_GATE)
+            return false;
+    }
+    return true;
 }
 
 /**
- * __fclk_change_state() - change clock state.
+ * __fclk_make_plan() - resolve the transition to a clock state.
  *
  * @this:       Pointer to the fclk device data.
- * @next:	next state to change.
+ * @state:      state to change to.
+ * @plan:       plan to make.
  * Return:      Success(=0) or error status(<0).
  *
+ * The resource clock is looked up in the clock chain and the rate is
+ * rounded here, so that an unreachable rate or an invalid resource clock
+ * is found before the clock is touched.
  */
-static int __fclk_change_state(struct fclk_device_data* this, struct fclk_state* next)
+static int __fclk_make_plan(struct fclk_device_data* this, struct fclk_state* state, struct fclk_plan* plan)
+{
+    int  retval;
+    long round_rate;
+
+    plan->valid        = false;
+    plan->resclk_valid = state->resclk_valid;
+    plan->resclk       = state->resclk;
+    plan->resclk_child = NULL;
+    plan->resclk_clk   = NULL;
+    if (plan->resclk_valid == true) {
+        retval = __fclk_find_resource(this, state->resclk, &plan->resclk_child, &plan->resclk_clk);
+        if (retval)
+            return retval;
+    }
+
+    plan->rate_valid = state->rate_valid;
+    plan->rate       = state->rate;
+    plan->round_rate = 0;
+    if (plan->rate_valid == true) {
+        round_rate = clk_round_rate(this->clk, state->rate);
+        if (round_rate <= 0) {
+            dev_err(this->device, "rate(%lu) is not reachable.\n", state->rate);
+            return -EINVAL;
+        }
+        /*
+         * The rounded rate depends on the resource clock, so it is left
+         * to be rounded when the resource clock is changed.
+         */
+        if ((plan->resclk_valid == false) || (plan->resclk == this->resource_clk_id))
+            plan->round_rate = round_rate;
+    }
+
+    plan->hitless = __fclk_hitless(this, plan);
+    plan->valid   = true;
+    return 0;
+}
+
+/**
+ * __fclk_exec_plan() - change clock state by a plan.
+ *
+ * @this:         Pointer to the fclk device data.
+ * @plan:         plan made by __fclk_make_plan().
+ * @set_clock:    change the rate and the resource clock of the plan.
+ * @enable_valid: change the enable of the clock.
+ * @enable:       enable of the clock.
+ * Return:        Success(=0) or error status(<0).
+ *
+ * Only the operations that actually change the hardware are done.  In
+ * particular the clock is not gated when neither the rate nor the resource
+ * clock changes, or when the plan can be done without gating.  The number
+ * of operations saved this way is counted in elided_transitions.
+ */
+static int __fclk_exec_plan(struct fclk_device_data* this, struct fclk_plan* plan, bool set_clock, bool enable_valid, bool enable)
 {
     int  retval      = 0;
     bool prev_enable = __clk_is_enabled(this->clk);
-    bool next_enable = (next->enable_valid == true) ? next->enable : prev_enable;
-    bool next_resclk = ((next->resclk_valid == true) &&
-                        (next->resclk != this->resource_clk_id));
-
-    if (((next->rate_valid == true) || (next_resclk == true)) && (prev_enable == true)) {
+    bool next_enable = (enable_valid == true) ? enable : prev_enable;
+    bool rate_valid  = ((set_clock == true) && (plan->rate_valid == true));
+    bool next_resclk = ((set_clock == true) && (plan->resclk_valid == true) &&
+                        (plan->resclk != this->resource_clk_id));
+    bool next_rate   = ((rate_valid == true) &&
+                        ((next_resclk == true) || (plan->round_rate == 0) ||
+                         (plan->round_rate != clk_get_rate(this->clk))));
+    bool gate_clock  = (((next_rate  == true) || (next_resclk == true)) && (prev_enable == true) &&
+                        (plan->hitless == false));
+    bool keep_clock  = (((rate_valid == true) || (next_resclk == true)) && (prev_enable == true) &&
+                        (gate_clock == false) && (next_enable == true));
+    unsigned long elided = 0;
+
+    if (gate_clock == true) {
         if (0 != (retval = __fclk_set_enable(this, false)))
-            return retval;
+            goto done;
         prev_enable = false;
+    } else if (keep_clock == true) {
+        elided++;   /* the clock is not gated around the change */
     }
     if (next_resclk == true) {
-        if (0 != (retval = __fclk_change_resource(this, next->resclk)))
-            return retval;
+        if (plan->resclk_child != NULL) {
+            if (0 != (retval = clk_set_parent(plan->resclk_child, plan->resclk_clk))) {
+                dev_err(this->device, "clk_set_parent(%s, %s) failed.\n" , __clk_get_name(plan->resclk_child), __clk_get_name(plan->resclk_clk));
+                goto done;
+            }
+        }
+        this->resource_clk_id = plan->resclk;
     }
-    if (next->rate_valid == true) {
-        if (0 != (retval = __fclk_set_rate(this, next->rate)))
-            return retval;
+    if (next_rate == true) {
+        if (0 != (retval = __fclk_set_rate(this, plan->rate, (next_resclk == true) ? 0 : plan->round_rate)))
+            goto done;
+    } else if (rate_valid == true) {
+        elided++;   /* the clock already runs at the rate */
     }
     if (prev_enable != next_enable) {
         if (0 != (retval = __fclk_set_enable(this, next_enable)))
-            return retval;
+            goto done;
+    } else if (keep_clock == true) {
+        elided++;   /* the clock is not enabled again after the change */
+    }
+ done:
+    if (elided > 0) {
+        this->elided_transitions += elided;
+        DEV_DBG(this->device, "elided %lu transitions.", elided);
     }
     return retval;
 }
 
+/**
+ * __fclk_change_state() - change clock state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:	next state to change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+static int __fclk_change_state(struct fclk_device_data* this, struct fclk_state* next)
+{
+    struct fclk_plan plan;
+    int              retval;
+
+    if (0 != (retval = __fclk_make_plan(this, next, &plan)))
+        return retval;
+
+    return __fclk_exec_plan(this, &plan, true, next->enable_valid, next->enable);
+}
+
+/**
+ * __fclk_normal_rate() - the rate of the clock while it is not limited.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @region:     region state.
+ * Return:      the region rate, or the rate of the clock at probe if there
+ *              is none.
+ */
+static unsigned long __fclk_normal_rate(struct fclk_device_data* this, struct fclk_state* region)
+{
+    if (region->rate_valid == true)
+        return region->rate;
+    return this->probe_rate;
+}
+
+/**
+ * __fclk_rate_ceiling() - limit a rate to the region rate and the thermal limit.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @region:     region state.
+ * @rate:       rate.
+ * Return:      the limited rate.
+ *
+ * Cooling state N of cooling-steps limits the rate to
+ * (cooling-steps + 1 - N) / (cooling-steps + 1) of the normal rate of
+ * @region, so the ceiling follows the region rate of each FPGA image.
+ */
+static unsigned long __fclk_rate_ceiling(struct fclk_device_data* this, struct fclk_state* region, unsigned long rate)
+{
+    if ((region->rate_valid == true) && (rate > region->rate))
+        rate = region->rate;
+#if (USE_THERMAL == 1)
+    if (this->cooling_state != 0) {
+        unsigned long normal_rate = __fclk_normal_rate(this, region);
+        unsigned long rate_limit;
+        long          round_rate;
+
+        round_rate = clk_round_rate(this->clk, mult_frac(normal_rate, this->cooling_steps + 1 - this->cooling_state, this->cooling_steps + 1));
+        rate_limit = (round_rate > 0) ? round_rate : 1;
+        if (rate > rate_limit)
+            rate = rate_limit;
+    }
+#endif
+    return rate;
+}
+
+/**
+ * __fclk_plan_region_state() - make the plan of a region state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @region:     region state.
+ * @plan:       plan to make.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int __fclk_plan_region_state(struct fclk_device_data* this, struct fclk_state* region, struct fclk_plan* plan)
+{
+    struct fclk_state state;
+
+    /*
+     * A cooling device sets the rate while it is cooling, so that the
+     * ceiling applies to a region state without rate.  At cooling state 0
+     * the rate is left alone, see fpga_region_clock_cooling_set_cur_state().
+     */
+    state = *region;
+#if (USE_THERMAL == 1)
+    if ((state.rate_valid == false) && (this->cooling_state != 0)) {
+        state.rate_valid = true;
+        state.rate       = this->probe_rate;
+    }
+#endif
+    if (state.rate_valid == true)
+        state.rate = __fclk_rate_ceiling(this, region, state.rate);
+
+    return __fclk_make_plan(this, &state, plan);
+}
+
+/**
+ * __fclk_plan_region() - make the plan of the region state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The plan is made when the region state is set up, before the FPGA region
+ * is disabled, and is kept until the region state changes.
+ */
+static int __fclk_plan_region(struct fclk_device_data* this)
+{
+    if (this->region_plan.valid == true)
+        return 0;
+
+    return __fclk_plan_region_state(this, &this->region, &this->region_plan);
+}
+
+/**
+ * __fclk_state_modified() - note that a state has been modified.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @state:      modified state.
+ */
+static void __fclk_state_modified(struct fclk_device_data* this, struct fclk_state* state)
+{
+    if (state == &this->region)
+        this->region_plan.valid = false;
+}
+
 /**
  * DOC: fclk system class device file show/set operations.
  *
@@ -371,6 +692,7 @@ static int __fclk_change_state(struct fclk_device_data* this, struct fclk_state*
  * * /sys/class/<class-name>/<device-name>/remove_enable
  * * /sys/class/<class-name>/<device-name>/remove_rate
  * * /sys/class/<class-name>/<device-name>/remove_resource
+ * * /sys/class/<class-name>/<device-name>/elided_transitions
  */
 /**
  * fclk_show_driver_version()
@@ -407,7 +729,10 @@ static ssize_t fclk_set_enable(struct fclk_device_data* this, struct device_attr
     if (0 != (get_result = kstrtoul(buf, 0, &enable)))
         return get_result;
 
-    if (0 != (set_result = __fclk_set_enable(this, (enable != 0))))
+    mutex_lock(&this->lock);
+    set_result = __fclk_set_enable(this, (enable != 0));
+    mutex_unlock(&this->lock);
+    if (set_result)
         return (ssize_t)set_result;
 
     return size;
@@ -444,12 +769,25 @@ static ssize_t fclk_set_rate(struct fclk_device_data* this, struct device_attrib
     next_state.resclk       = 0;
     next_state.resclk_valid = false;
 
-    if (0 != (set_result = __fclk_change_state(this, &next_state)))
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
         return (ssize_t)set_result;
 
     return size;
 }
 
+/**
+ * fclk_show_elided_transitions()
+ */
+static ssize_t fclk_show_elided_transitions(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", this->elided_transitions);
+}
+
 /**
  * fclk_show_round_rate()
  */
@@ -511,7 +849,10 @@ static ssize_t fclk_set_resource(struct fclk_device_data* this, struct device_at
     next_state.resclk       = resclk;
     next_state.resclk_valid = true;
 
-    if (0 != (set_result = __fclk_change_state(this, &next_state)))
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
         return (ssize_t)set_result;
 
     return size;
@@ -585,9 +926,12 @@ static ssize_t fclk_set_ ## state ## _enable(   \
     if (!this) return -ENODEV;                  \
     if (0 != (get_result = kstrtol(buf, 0, &enable))) \
         return get_result; \
+    mutex_lock(&this->lock); \
     if      (enable  > 0) {this->state.enable_valid = true ;this->state.enable = true ;} \
     else if (enable == 0) {this->state.enable_valid = true ;this->state.enable = false;} \
     else                  {this->state.enable_valid = false;} \
+    __fclk_state_modified(this, &this->state); \
+    mutex_unlock(&this->lock); \
     return size; \
 }
 
@@ -620,8 +964,11 @@ static ssize_t fclk_set_ ## state ## _rate(     \
     if (!this) return -ENODEV;                  \
     if (0 != (get_result = kstrtol(buf, 0, &rate))) \
         return get_result; \
+    mutex_lock(&this->lock); \
     if   (rate >= 0) {this->state.rate_valid = true ;this->state.rate = (unsigned long)rate;} \
     else             {this->state.rate_valid = false;} \
+    __fclk_state_modified(this, &this->state); \
+    mutex_unlock(&this->lock); \
     return size; \
 }
 
@@ -655,16 +1002,18 @@ static ssize_t fclk_set_ ## state ## _resource(  \
     if ((this->resource_clks != NULL) && (this->resource_clks_size > 0)) { \
         if (0 != (get_result = kstrtol(buf, 0, &resource))) \
             return get_result; \
-        if ((resource >= 0) && (resource < this->resource_clks_size)) { \
+        if (resource >= this->resource_clks_size) \
+            return -EINVAL; \
+        mutex_lock(&this->lock); \
+        if (resource >= 0) { \
             this->state.resclk_valid = true; \
             this->state.resclk       = (unsigned long)resource; \
-            return size; \
-        } \
-        if (resource < 0) { \
+        } else { \
             this->state.resclk_valid = false; \
-            return size; \
         } \
-        return -EINVAL; \
+        __fclk_state_modified(this, &this->state); \
+        mutex_unlock(&this->lock); \
+        return size; \
     } \
     return size;\
 }
@@ -732,6 +1081,7 @@ static void fclk_device_info(struct fclk_device_data* this, struct platform_devi
     dev_info(dev, "clock  name    : %s\n" , __clk_get_name(this->clk));
     dev_info(dev, "clock  rate    : %lu\n", clk_get_rate(this->clk));
     dev_info(dev, "clock  enabled : %d\n" , __clk_is_enabled(this->clk));
+    dev_info(dev, "hitless change : %d\n" , this->hitless_rate_change);
     RES_INFO(dev, "resource clock : "     , this->resource_clk_id);
     if ((this->resource_clks != NULL) && (this->resource_clks_size > 1)) {
         int i;
@@ -855,6 +1205,11 @@ static int fclk_device_setup(struct fclk_device_data* this, struct device *dev)
     }
     DEV_DBG(dev, "of_clk_get(1..) done.\n");
 
+    /*
+     * get hitless-rate-change property
+     */
+    this->hitless_rate_change = of_property_read_bool(dev->of_node, "hitless-rate-change");
+
     /*
      * get insert state
      */
@@ -901,6 +1256,10 @@ static int fclk_device_setup(struct fclk_device_data* this, struct device *dev)
     if (retval)
         goto failed;
 
+    retval = __fclk_plan_region(this);
+    if (retval)
+        goto failed;
+
     return 0;
 
  failed:
@@ -1040,6 +1399,10 @@ DEF_FPGA_REGION_CLOCK_SET (region_rate);
  */
 DEF_FPGA_REGION_CLOCK_SHOW(region_resource);
 DEF_FPGA_REGION_CLOCK_SET (region_resource);
+/**
+ * fpga_region_clock_show_elided_transitions()
+ */
+DEF_FPGA_REGION_CLOCK_SHOW(elided_transitions);
 
 static struct device_attribute fpga_region_clock_device_attrs[] = {
   __ATTR(driver_version , 0444, fpga_region_clock_show_driver_version , NULL                                 ),
@@ -1054,6 +1417,7 @@ static struct device_attribute fpga_region_clock_device_attrs[] = {
   __ATTR(region_enable   , 0664, fpga_region_clock_show_region_enable   , fpga_region_clock_set_region_enable   ),
   __ATTR(region_rate     , 0664, fpga_region_clock_show_region_rate     , fpga_region_clock_set_region_rate     ),
   __ATTR(region_resource , 0664, fpga_region_clock_show_region_resource , fpga_region_clock_set_region_resource ),
+  __ATTR(elided_transitions, 0444, fpga_region_clock_show_elided_transitions, NULL                               ),
   __ATTR_NULL,
 };
 
@@ -1070,6 +1434,7 @@ static struct attribute *fpga_region_clock_attrs[] = {
   &(fpga_region_clock_device_attrs[ 9].attr),
   &(fpga_region_clock_device_attrs[10].attr),
   &(fpga_region_clock_device_attrs[11].attr),
+  &(fpga_region_clock_device_attrs[12].attr),
   NULL
 };
 static struct attribute_group  fpga_region_clock_attr_group = {
@@ -1086,41 +1451,31 @@ static const struct attribute_group* fpga_region_clock_attr_groups[] = {
 static int fpga_region_clock_enable_set(struct fpga_region_interface *interface, bool enable)
 {
     struct fclk_device_data* this = interface->priv;
-    struct fclk_state        next_state;
     int                      retval;
 
     DEV_DBG(this->device, "%s(%d) start.\n", __func__, enable);
     
-    if (enable == true) {
-        next_state.rate         = this->region.rate;
-        next_state.rate_valid   = false;
-        next_state.enable       = this->region.enable;
-        next_state.enable_valid = this->region.enable_valid;
-        next_state.resclk       = 0;
-        next_state.resclk_valid = false;
-    } else if ((this->region.rate_valid == true) || (this->region.resclk_valid == true)) {
-        next_state.rate         = this->region.rate;
-        next_state.rate_valid   = this->region.rate_valid;
-        next_state.enable       = false;
-        next_state.enable_valid = true;
-        next_state.resclk       = this->region.resclk;
-        next_state.resclk_valid = this->region.resclk_valid;
-    } else {
-        next_state.rate         = this->region.rate;
-        next_state.rate_valid   = false;
-        next_state.enable       = false;
-        next_state.enable_valid = false;
-        next_state.resclk       = 0;
-        next_state.resclk_valid = false;
+    mutex_lock(&this->lock);
+
+    retval = __fclk_plan_region(this);
+
+    if (retval == 0) {
+        if (enable == true)
+            retval = __fclk_exec_plan(this, &this->region_plan, false, this->region.enable_valid, this->region.enable);
+        else if ((this->region_plan.rate_valid == true) || (this->region_plan.resclk_valid == true))
+            retval = __fclk_exec_plan(this, &this->region_plan, true , true , false);
+        else
+            retval = __fclk_exec_plan(this, &this->region_plan, false, false, false);
     }
 
-    retval = __fclk_change_state(this, &next_state);
+    if (retval == 0)
+        this->bridge_enable = enable;
+
+    mutex_unlock(&this->lock);
 
     if (retval)
         goto failed;
 
-    this->bridge_enable = enable;
-
     DEV_DBG(this->device, "%s(%d) success.\n", __func__, enable);
     return 0;
 
@@ -1145,10 +1500,122 @@ static int fpga_region_clock_enable_show(struct fpga_region_interface *interface
 static int fpga_region_clock_of_setup(struct fpga_region_interface *interface, struct device_node* of_node)
 {
     struct fclk_device_data* this = interface->priv;
-    return fclk_device_get_state_property(
-               this, this->device, of_node,
-               "region-rate", "region-enable", "region-resource",  &this->region
-           );
+    int                      retval;
+
+    mutex_lock(&this->lock);
+
+    retval = fclk_device_get_state_property(
+                 this, this->device, of_node,
+                 "region-rate", "region-enable", "region-resource",  &this->region
+             );
+    __fclk_state_modified(this, &this->region);
+    /*
+     * Resolve the transition now, so that a region state the clock can
+     * not reach fails the FPGA programming before the region is disabled.
+     */
+    if (retval == 0)
+        retval = __fclk_plan_region(this);
+
+    mutex_unlock(&this->lock);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_of_check() - fpga_region_interface of_check operation.
+ *
+ * Reads the region state of the node and resolves its transition as
+ * fpga_region_clock_of_setup() does, but into a copy of the region state.
+ */
+static int fpga_region_clock_of_check(struct fpga_region_interface *interface, struct device_node* of_node)
+{
+    struct fclk_device_data* this = interface->priv;
+    struct fclk_state        region;
+    struct fclk_plan         plan;
+    int                      retval;
+
+    mutex_lock(&this->lock);
+
+    region = this->region;
+    retval = fclk_device_get_state_property(
+                 this, this->device, of_node,
+                 "region-rate", "region-enable", "region-resource",  &region
+             );
+    if (retval == 0)
+        retval = __fclk_plan_region_state(this, &region, &plan);
+
+    mutex_unlock(&this->lock);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_setup() - fpga_region_interface setup operation.
+ */
+static int fpga_region_clock_setup(struct fpga_region_interface *interface, const struct fpga_region_interface_setting* setting)
+{
+    struct fclk_device_data* this = interface->priv;
+    int                      retval;
+
+    if (setting->flags & FPGA_REGION_INTERFACE_SETTING_RESOURCE) {
+        if ((this->resource_clks != NULL) &&
+            (setting->resource >= this->resource_clks_size)) {
+            dev_err(this->device, "invalid region-resource(=%u).\n", setting->resource);
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&this->lock);
+
+    if (setting->flags & FPGA_REGION_INTERFACE_SETTING_RESOURCE) {
+        this->region.resclk_valid = true;
+        this->region.resclk       = setting->resource;
+    }
+    if (setting->flags & FPGA_REGION_INTERFACE_SETTING_RATE) {
+        this->region.rate_valid   = true;
+        this->region.rate         = setting->rate;
+    }
+    if (setting->flags & FPGA_REGION_INTERFACE_SETTING_ENABLE) {
+        this->region.enable_valid = true;
+        this->region.enable       = setting->enable;
+    }
+    __fclk_state_modified(this, &this->region);
+    retval = __fclk_plan_region(this);
+
+    mutex_unlock(&this->lock);
+
+    DEV_DBG(this->device, "%s(flags=0x%x) done.\n", __func__, setting->flags);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_update() - fpga_region_interface update operation.
+ *
+ * Changes the clock to the region state while it is enabled.  Only what
+ * differs from the current state is changed, see __fclk_exec_plan().
+ * While the clock is disabled, the region state is applied the next time
+ * it is enabled.
+ */
+static int fpga_region_clock_update(struct fpga_region_interface *interface)
+{
+    struct fclk_device_data* this = interface->priv;
+    int                      retval = 0;
+
+    DEV_DBG(this->device, "%s start.\n", __func__);
+
+    mutex_lock(&this->lock);
+
+    if (this->bridge_enable == true) {
+        retval = __fclk_plan_region(this);
+        if (retval == 0)
+            retval = __fclk_exec_plan(this, &this->region_plan, true, this->region.enable_valid, this->region.enable);
+    }
+
+    mutex_unlock(&this->lock);
+
+    if (retval)
+        DEV_DBG(this->device, "%s failed(%d).\n", __func__, retval);
+    else
+        DEV_DBG(this->device, "%s success.\n", __func__);
+    return retval;
 }
 
 /**
@@ -1158,9 +1625,458 @@ static const struct fpga_region_interface_ops fpga_region_clock_interface_ops =
 	.enable_set  = fpga_region_clock_enable_set,
 	.enable_show = fpga_region_clock_enable_show,
 	.of_setup    = fpga_region_clock_of_setup,
+	.of_check    = fpga_region_clock_of_check,
+	.setup       = fpga_region_clock_setup,
+	.update      = fpga_region_clock_update,
         .groups      = fpga_region_clock_attr_groups,
 };
 
+/**
+ * DOC: fpga_region_clock devfreq operations
+ *
+ * A fpga-region-clock with the devfreq-governor property is registered as
+ * a devfreq device, whose rates are the normal rate at probe divided into
+ * devfreq-steps steps and rounded by clk_round_rate().  These rates stand
+ * for the same fractions of the current normal rate, so the steps follow
+ * the region rate of each FPGA image without rebuilding the OPP table.
+ * The rate is changed by devfreq only while the FPGA region is operating,
+ * and never above the region rate or the thermal limit.
+ *
+ * The load is reported by the load source set with
+ * fpga_region_clock_set_load_source().  Without a load source the clock
+ * is reported as fully loaded.
+ *
+ * * fpga_region_clock_devfreq_to_rate()        - convert a devfreq rate to a clock rate.
+ * * fpga_region_clock_devfreq_from_rate()      - convert a clock rate to a devfreq rate.
+ * * fpga_region_clock_devfreq_target()         - devfreq target operation.
+ * * fpga_region_clock_devfreq_get_dev_status() - devfreq get_dev_status operation.
+ * * fpga_region_clock_devfreq_get_cur_freq()   - devfreq get_cur_freq operation.
+ * * fpga_region_clock_devfreq_setup()          - register the devfreq device.
+ * * fpga_region_clock_devfreq_cleanup()        - unregister the devfreq device.
+ * * fpga_region_clock_set_load_source()        - set the load source.
+ * * fpga_region_clock_clear_load_source()      - clear the load source.
+ */
+#if (USE_DEVFREQ == 1)
+/**
+ * fpga_region_clock_devfreq_to_rate() - convert a devfreq rate to a clock rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @freq:       rate of the devfreq OPP table.
+ * Return:      the same fraction of the current normal rate.
+ */
+static unsigned long fpga_region_clock_devfreq_to_rate(struct fclk_device_data* this, unsigned long freq)
+{
+    return div64_u64((u64)freq * __fclk_normal_rate(this, &this->region), this->devfreq_max_rate);
+}
+
+/**
+ * fpga_region_clock_devfreq_from_rate() - convert a clock rate to a devfreq rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @rate:       rate of the clock.
+ * Return:      the same fraction of the rate the OPP table was built from.
+ */
+static unsigned long fpga_region_clock_devfreq_from_rate(struct fclk_device_data* this, unsigned long rate)
+{
+    unsigned long normal_rate = __fclk_normal_rate(this, &this->region);
+
+    if (normal_rate == 0)
+        return rate;
+    return div64_u64((u64)rate * this->devfreq_max_rate, normal_rate);
+}
+
+/**
+ * fpga_region_clock_devfreq_target() - devfreq target operation.
+ */
+static int fpga_region_clock_devfreq_target(struct device *dev, unsigned long *freq, u32 flags)
+{
+    struct fclk_device_data* this = dev_get_drvdata(dev);
+    struct dev_pm_opp*       opp;
+    struct fclk_state        next_state;
+    unsigned long            rate;
+    int                      retval = 0;
+
+    opp = devfreq_recommended_opp(dev, freq, flags);
+    if (IS_ERR(opp))
+        return PTR_ERR(opp);
+    rate = dev_pm_opp_get_freq(opp);
+    dev_pm_opp_put(opp);
+
+    mutex_lock(&this->lock);
+
+    rate = __fclk_rate_ceiling(this, &this->region, fpga_region_clock_devfreq_to_rate(this, rate));
+
+    if (this->bridge_enable == true) {
+        next_state.rate         = rate;
+        next_state.rate_valid   = true;
+        next_state.enable       = false;
+        next_state.enable_valid = false;
+        next_state.resclk       = 0;
+        next_state.resclk_valid = false;
+        retval = __fclk_change_state(this, &next_state);
+    }
+    *freq = fpga_region_clock_devfreq_from_rate(this, clk_get_rate(this->clk));
+
+    mutex_unlock(&this->lock);
+
+    DEV_DBG(this->device, "%s(%lu) done(%d).\n", __func__, rate, retval);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_devfreq_get_dev_status() - devfreq get_dev_status operation.
+ */
+static int fpga_region_clock_devfreq_get_dev_status(struct device *dev, struct devfreq_dev_status *stat)
+{
+    struct fclk_device_data* this   = dev_get_drvdata(dev);
+    int                      retval = 0;
+
+    mutex_lock(&this->lock);
+
+    stat->current_frequency = fpga_region_clock_devfreq_from_rate(this, clk_get_rate(this->clk));
+    if ((this->load_ops != NULL) && (this->load_ops->get_load != NULL)) {
+        retval = this->load_ops->get_load(this->load_data, &stat->busy_time, &stat->total_time);
+    } else {
+        stat->busy_time  = 1;
+        stat->total_time = 1;
+    }
+
+    mutex_unlock(&this->lock);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_devfreq_get_cur_freq() - devfreq get_cur_freq operation.
+ */
+static int fpga_region_clock_devfreq_get_cur_freq(struct device *dev, unsigned long *freq)
+{
+    struct fclk_device_data* this = dev_get_drvdata(dev);
+
+    mutex_lock(&this->lock);
+    *freq = fpga_region_clock_devfreq_from_rate(this, clk_get_rate(this->clk));
+    mutex_unlock(&this->lock);
+    return 0;
+}
+
+/**
+ * fpga_region_clock_devfreq_cleanup() - unregister the devfreq device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the platform device structure.
+ */
+static void fpga_region_clock_devfreq_cleanup(struct fclk_device_data* this, struct device* dev)
+{
+    int i;
+
+    if (this->devfreq != NULL) {
+        devfreq_remove_device(this->devfreq);
+        this->devfreq = NULL;
+    }
+    for (i = 0; i < this->devfreq_rates_size; i++)
+        dev_pm_opp_remove(dev, this->devfreq_rates[i]);
+    kfree(this->devfreq_rates);
+    this->devfreq_rates      = NULL;
+    this->devfreq_rates_size = 0;
+}
+
+/**
+ * fpga_region_clock_devfreq_setup() - register the devfreq device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the platform device structure, with @this as drvdata.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+static int fpga_region_clock_devfreq_setup(struct fclk_device_data* this, struct device* dev)
+{
+    const char*   governor;
+    u32           steps      = 8;
+    u32           polling_ms = 100;
+    unsigned long max_rate;
+    long          round_rate;
+    int           retval;
+    u32           i;
+
+    if (of_property_read_string(dev->of_node, "devfreq-governor", &governor))
+        return 0;
+
+    of_property_read_u32(dev->of_node, "devfreq-steps"     , &steps);
+    of_property_read_u32(dev->of_node, "devfreq-polling-ms", &polling_ms);
+
+    max_rate = __fclk_normal_rate(this, &this->region);
+    if ((steps == 0) || (max_rate == 0)) {
+        dev_err(dev, "invalid devfreq-steps(=%u) or rate(=%lu).\n", steps, max_rate);
+        return -EINVAL;
+    }
+
+    this->devfreq_rates = kcalloc(steps, sizeof(*this->devfreq_rates), GFP_KERNEL);
+    if (this->devfreq_rates == NULL)
+        return -ENOMEM;
+
+    for (i = 1; i <= steps; i++) {
+        round_rate = clk_round_rate(this->clk, mult_frac(max_rate, i, steps));
+        if ((round_rate <= 0) || ((unsigned long)round_rate > max_rate))
+            continue;
+        /* Steps that round to the same rate are added once. */
+        if (dev_pm_opp_add(dev, round_rate, 0))
+            continue;
+        this->devfreq_rates[this->devfreq_rates_size++] = round_rate;
+    }
+    if (this->devfreq_rates_size == 0) {
+        dev_err(dev, "no devfreq rate is reachable.\n");
+        retval = -EINVAL;
+        goto failed;
+    }
+    this->devfreq_max_rate = max_rate;
+
+    this->devfreq_profile.initial_freq   = fpga_region_clock_devfreq_from_rate(this, clk_get_rate(this->clk));
+    this->devfreq_profile.polling_ms     = polling_ms;
+    this->devfreq_profile.target         = fpga_region_clock_devfreq_target;
+    this->devfreq_profile.get_dev_status = fpga_region_clock_devfreq_get_dev_status;
+    this->devfreq_profile.get_cur_freq   = fpga_region_clock_devfreq_get_cur_freq;
+
+    this->devfreq = devfreq_add_device(dev, &this->devfreq_profile, governor, NULL);
+    if (IS_ERR(this->devfreq)) {
+        retval = PTR_ERR(this->devfreq);
+        this->devfreq = NULL;
+        dev_err(dev, "devfreq_add_device(%s) failed. return=%d.\n", governor, retval);
+        goto failed;
+    }
+    return 0;
+
+ failed:
+    fpga_region_clock_devfreq_cleanup(this, dev);
+    return retval;
+}
+
+/**
+ * fpga_region_clock_set_load_source() - set the load source of a fpga-region-clock.
+ *
+ * @np:         device tree node of the fpga-region-clock.
+ * @ops:        load source operations.
+ * @data:       passed to @ops.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+int fpga_region_clock_set_load_source(struct device_node *np, const struct fpga_region_clock_load_ops *ops, void *data)
+{
+    struct platform_device*  pdev = of_find_device_by_node(np);
+    struct fclk_device_data* this;
+    int                      retval = 0;
+
+    if (pdev == NULL)
+        return -ENODEV;
+
+    device_lock(&pdev->dev);
+    this = platform_get_drvdata(pdev);
+    if (this != NULL) {
+        mutex_lock(&this->lock);
+        this->load_ops  = ops;
+        this->load_data = data;
+        mutex_unlock(&this->lock);
+    } else {
+        retval = -ENODEV;
+    }
+    device_unlock(&pdev->dev);
+    put_device(&pdev->dev);
+    return retval;
+}
+EXPORT_SYMBOL_GPL(fpga_region_clock_set_load_source);
+
+/**
+ * fpga_region_clock_clear_load_source() - clear the load source of a fpga-region-clock.
+ *
+ * @np:         device tree node of the fpga-region-clock.
+ */
+void fpga_region_clock_clear_load_source(struct device_node *np)
+{
+    fpga_region_clock_set_load_source(np, NULL, NULL);
+}
+EXPORT_SYMBOL_GPL(fpga_region_clock_clear_load_source);
+#else
+static int  fpga_region_clock_devfreq_setup(struct fclk_device_data* this, struct device* dev)
+{
+    if (of_property_read_bool(dev->of_node, "devfreq-governor"))
+        dev_warn(dev, "devfreq is not supported by this kernel.\n");
+    return 0;
+}
+static void fpga_region_clock_devfreq_cleanup(struct fclk_device_data* this, struct device* dev)
+{
+}
+int fpga_region_clock_set_load_source(struct device_node *np, const struct fpga_region_clock_load_ops *ops, void *data)
+{
+    return -ENODEV;
+}
+EXPORT_SYMBOL_GPL(fpga_region_clock_set_load_source);
+void fpga_region_clock_clear_load_source(struct device_node *np)
+{
+}
+EXPORT_SYMBOL_GPL(fpga_region_clock_clear_load_source);
+#endif
+
+/**
+ * DOC: fpga_region_clock thermal operations
+ *
+ * A fpga-region-clock with the #cooling-cells property is registered as a
+ * thermal cooling device.  Cooling state 0 sets no ceiling, and the clock
+ * returns to its normal rate, the region rate or the rate of the clock at
+ * probe if there is none, when it is entered.  A region state without
+ * rate then leaves the rate of the clock alone.  Each of the cooling-steps
+ * (4 by default) further states lowers the ceiling of the rate by another
+ * 1/(cooling-steps + 1) of the normal rate.  The ceiling is computed from
+ * the current region rate, and applies to the region state and to devfreq.
+ *
+ * * fpga_region_clock_cooling_get_max_state() - cooling get_max_state operation.
+ * * fpga_region_clock_cooling_get_cur_state() - cooling get_cur_state operation.
+ * * fpga_region_clock_cooling_set_cur_state() - cooling set_cur_state operation.
+ * * fpga_region_clock_cooling_setup()         - register the cooling device.
+ * * fpga_region_clock_cooling_cleanup()       - unregister the cooling device.
+ */
+#if (USE_THERMAL == 1)
+/**
+ * fpga_region_clock_cooling_get_max_state() - cooling get_max_state operation.
+ */
+static int fpga_region_clock_cooling_get_max_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+    struct fclk_device_data* this = cdev->devdata;
+
+    *state = this->cooling_steps;
+    return 0;
+}
+
+/**
+ * fpga_region_clock_cooling_get_cur_state() - cooling get_cur_state operation.
+ */
+static int fpga_region_clock_cooling_get_cur_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+    struct fclk_device_data* this = cdev->devdata;
+
+    mutex_lock(&this->lock);
+    *state = this->cooling_state;
+    mutex_unlock(&this->lock);
+    return 0;
+}
+
+/**
+ * fpga_region_clock_cooling_set_cur_state() - cooling set_cur_state operation.
+ *
+ * Only the cooling state is kept; the ceiling is computed from the region
+ * rate whenever it is applied.  The new ceiling is applied at once while
+ * the FPGA region is operating.  Otherwise it is applied when the region
+ * is programmed next, except that the normal rate is restored at once when
+ * the cooling is over, because the region state of a clock without region
+ * rate does not set the rate at cooling state 0.
+ */
+static int fpga_region_clock_cooling_set_cur_state(struct thermal_cooling_device *cdev, unsigned long state)
+{
+    struct fclk_device_data* this   = cdev->devdata;
+    struct fclk_state        next_state;
+    unsigned long            normal_rate;
+    int                      retval = 0;
+
+    if (state > this->cooling_steps)
+        return -EINVAL;
+
+    mutex_lock(&this->lock);
+
+    if (state == this->cooling_state)
+        goto done;
+
+    this->cooling_state = state;
+    __fclk_state_modified(this, &this->region);
+
+    if ((this->bridge_enable == true) || (state == 0)) {
+        normal_rate = __fclk_normal_rate(this, &this->region);
+        /*
+         * devfreq, if any, raises the rate again by itself when the
+         * cooling is over, so only a rate above the ceiling is lowered.
+         */
+#if (USE_DEVFREQ == 1)
+        if ((this->bridge_enable == true) && (this->devfreq != NULL))
+            normal_rate = clk_get_rate(this->clk);
+#endif
+        next_state.rate         = __fclk_rate_ceiling(this, &this->region, normal_rate);
+        next_state.rate_valid   = true;
+        next_state.enable       = false;
+        next_state.enable_valid = false;
+        next_state.resclk       = 0;
+        next_state.resclk_valid = false;
+        retval = __fclk_change_state(this, &next_state);
+    }
+
+ done:
+    mutex_unlock(&this->lock);
+    DEV_DBG(this->device, "%s(%lu) done(%d).\n", __func__, state, retval);
+    return retval;
+}
+
+static const struct thermal_cooling_device_ops fpga_region_clock_cooling_ops = {
+    .get_max_state = fpga_region_clock_cooling_get_max_state,
+    .get_cur_state = fpga_region_clock_cooling_get_cur_state,
+    .set_cur_state = fpga_region_clock_cooling_set_cur_state,
+};
+
+/**
+ * fpga_region_clock_cooling_cleanup() - unregister the cooling device.
+ *
+ * @this:       Pointer to the fclk device data.
+ */
+static void fpga_region_clock_cooling_cleanup(struct fclk_device_data* this)
+{
+    if (this->cooling != NULL) {
+        thermal_cooling_device_unregister(this->cooling);
+        this->cooling = NULL;
+    }
+}
+
+/**
+ * fpga_region_clock_cooling_setup() - register the cooling device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the platform device structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+static int fpga_region_clock_cooling_setup(struct fclk_device_data* this, struct device* dev)
+{
+    u32 steps = 4;
+    int retval;
+
+    if (!of_find_property(dev->of_node, "#cooling-cells", NULL))
+        return 0;
+
+    of_property_read_u32(dev->of_node, "cooling-steps", &steps);
+    if (steps == 0) {
+        dev_err(dev, "invalid cooling-steps(=%u).\n", steps);
+        return -EINVAL;
+    }
+
+    mutex_lock(&this->lock);
+    this->cooling_steps = steps;
+    __fclk_state_modified(this, &this->region);
+    mutex_unlock(&this->lock);
+
+    this->cooling = thermal_of_cooling_device_register(dev->of_node, (char *)dev_name(this->device), this, &fpga_region_clock_cooling_ops);
+    if (IS_ERR(this->cooling)) {
+        retval = PTR_ERR(this->cooling);
+        this->cooling = NULL;
+        dev_err(dev, "thermal_of_cooling_device_register failed. return=%d.\n", retval);
+        return retval;
+    }
+    return 0;
+}
+#else
+static int  fpga_region_clock_cooling_setup(struct fclk_device_data* this, struct device* dev)
+{
+    if (of_find_property(dev->of_node, "#cooling-cells", NULL))
+        dev_warn(dev, "thermal is not supported by this kernel.\n");
+    return 0;
+}
+static void fpga_region_clock_cooling_cleanup(struct fclk_device_data* this)
+{
+}
+#endif
+
 /**
  * fpga_region_clock_device_destroy() - Destroy the fpga_region_clock device.
  *
@@ -1208,6 +2124,7 @@ static struct fclk_device_data* fpga_region_clock_device_create(struct device *d
         }
         this->device        = NULL;
         this->clk           = NULL;
+        mutex_init(&this->lock);
     }
 
     /*
@@ -1254,6 +2171,7 @@ static struct fclk_device_data* fpga_region_clock_device_create(struct device *d
         retval = fclk_device_setup(this, dev);
         if (retval)
             goto failed;
+        this->probe_rate = clk_get_rate(this->clk);
     }
 
     return this;
@@ -1298,6 +2216,18 @@ static int fpga_region_clock_platform_driver_probe(struct platform_device *pdev)
 
     platform_set_drvdata(pdev, data);
 
+    retval = fpga_region_clock_cooling_setup(data, &pdev->dev);
+    if (retval == 0) {
+        retval = fpga_region_clock_devfreq_setup(data, &pdev->dev);
+        if (retval)
+            fpga_region_clock_cooling_cleanup(data);
+    }
+    if (retval) {
+        platform_set_drvdata(pdev, NULL);
+        fpga_region_clock_device_destroy(data);
+        goto failed;
+    }
+
     if (info_enable) {
         fclk_device_info(data, pdev);
     }
@@ -1325,8 +2255,14 @@ static int fpga_region_clock_platform_driver_remove(struct platform_device *pdev
     if (!this)
         return -ENODEV;
 
-    if (this->clk) 
+    fpga_region_clock_devfreq_cleanup(this, &pdev->dev);
+    fpga_region_clock_cooling_cleanup(this);
+
+    if (this->clk) {
+        mutex_lock(&this->lock);
         __fclk_change_state(this, &this->remove);
+        mutex_unlock(&this->lock);
+    }
 
     fpga_region_clock_device_destroy(this);
     platform_set_drvdata(pdev, NULL);
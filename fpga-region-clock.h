@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef _LINUX_FPGA_REGION_CLOCK_H
+#define _LINUX_FPGA_REGION_CLOCK_H
+
+#include <linux/of.h>
+
+/**
+ * struct fpga_region_clock_load_ops - load source of a fpga-region-clock
+ * @get_load: report the time the logic driven by the clock was busy, out
+ *            of the total time, since the last call
+ *
+ * The devfreq governors of a fpga-region-clock scale its rate by the load
+ * that its load source reports.
+ */
+struct fpga_region_clock_load_ops {
+	int (*get_load)(void *data, unsigned long *busy_time,
+			unsigned long *total_time);
+};
+
+int fpga_region_clock_set_load_source(struct device_node *np,
+				      const struct fpga_region_clock_load_ops *ops,
+				      void *data);
+void fpga_region_clock_clear_load_source(struct device_node *np);
+
+#endif /* _LINUX_FPGA_REGION_CLOCK_H */
@@ -8,15 +8,65 @@
 #include <linux/fpga/fpga-bridge.h>
 #include <linux/fpga/fpga-mgr.h>
 #include "fpga-region-core.h"
+#include <linux/dma-buf.h>
+#include <linux/hashtable.h>
+#include <linux/highmem.h>
+#include <linux/crc32.h>
 #include <linux/idr.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/zlib.h>
+#include <linux/zstd.h>
+#include <asm/unaligned.h>
+#include <crypto/hash.h>
 
 static DEFINE_IDA(fpga_region_core_ida);
 static struct class *fpga_region_core_class;
+static struct workqueue_struct *fpga_region_core_wq;
+
+/* Index of registered regions by device tree node */
+#define FPGA_REGION_CORE_INDEX_BITS 5
+static DEFINE_HASHTABLE(fpga_region_core_index, FPGA_REGION_CORE_INDEX_BITS);
+static DEFINE_SPINLOCK(fpga_region_core_index_lock);
+static unsigned int fpga_region_core_index_count;
+
+/* Woken up whenever the core releases a FPGA manager */
+static DECLARE_WAIT_QUEUE_HEAD(fpga_region_core_mgr_wq);
+
+/*
+ * Regions that hold their FPGA manager.  Queued requests wait for the claim
+ * instead of polling fpga_mgr_lock(), which logs an error on every failure.
+ */
+static LIST_HEAD(fpga_region_core_mgr_claims);
+static DEFINE_SPINLOCK(fpga_region_core_mgr_claim_lock);
+
+/*
+ * Queued requests retry a FPGA manager locked outside of the core this
+ * often, since fpga_mgr_lock() holders don't wake them.  fpga_mgr_lock()
+ * logs every failure, so the interval is kept long.  Everything the core
+ * releases wakes the waiters at once.
+ */
+#define FPGA_REGION_CORE_MGR_POLL	HZ
+
+static unsigned int cache_max_entries = 4;
+module_param(cache_max_entries, uint, 0644);
+MODULE_PARM_DESC(cache_max_entries, "maximum number of cached FPGA images (0 disables the cache)");
+
+static unsigned long cache_max_bytes = 64 * 1024 * 1024;
+module_param(cache_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(cache_max_bytes, "maximum total size of cached FPGA images");
 
 struct fpga_region_core *fpga_region_core_class_find(
 	struct device *start, const void *data,
@@ -28,89 +78,1942 @@ struct fpga_region_core *fpga_region_core_class_find(
 	if (!dev)
 		return NULL;
 
-	return to_fpga_region_core(dev);
+	return to_fpga_region_core(dev);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_class_find);
+
+/**
+ * fpga_region_core_find_by_of_node - find a registered region by device tree node
+ * @np: device tree node of the region
+ *
+ * Unlike fpga_region_core_class_find() this does not walk the class, so it
+ * is cheap enough to call for every device tree change in the system.
+ *
+ * Caller will need to put_device(&region->dev) when done.
+ *
+ * Return: FPGA region struct or NULL.
+ */
+struct fpga_region_core *fpga_region_core_find_by_of_node(struct device_node *np)
+{
+	struct fpga_region_core *region;
+	struct fpga_region_core *found = NULL;
+
+	if (!np || !READ_ONCE(fpga_region_core_index_count))
+		return NULL;
+
+	spin_lock(&fpga_region_core_index_lock);
+	hash_for_each_possible(fpga_region_core_index, region, index_node,
+			       (unsigned long)np) {
+		if (region->dev.of_node == np) {
+			get_device(&region->dev);
+			found = region;
+			break;
+		}
+	}
+	spin_unlock(&fpga_region_core_index_lock);
+
+	return found;
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_find_by_of_node);
+
+/**
+ * fpga_region_core_set_status - update the programming status of a region
+ * @region: FPGA region
+ * @status: new status
+ * @error: error code for FPGA_REGION_CORE_STATUS_ERROR
+ *
+ * Wakes up anyone polling the status attribute.
+ */
+static void fpga_region_core_set_status(struct fpga_region_core *region,
+					enum fpga_region_core_status status,
+					int error)
+{
+	spin_lock(&region->request_lock);
+	region->status       = status;
+	region->status_error = error;
+	spin_unlock(&region->request_lock);
+	sysfs_notify(&region->dev.kobj, NULL, "status");
+}
+
+/**
+ * fpga_region_core_get_status - read the programming status of a region
+ * @region: FPGA region
+ * @error: returns the error code for FPGA_REGION_CORE_STATUS_ERROR, or NULL
+ *
+ * The status and the error code are read together, so they always belong
+ * to the same programming.
+ */
+static enum fpga_region_core_status
+fpga_region_core_get_status(struct fpga_region_core *region, int *error)
+{
+	enum fpga_region_core_status status;
+
+	spin_lock(&region->request_lock);
+	status = region->status;
+	if (error)
+		*error = region->status_error;
+	spin_unlock(&region->request_lock);
+
+	return status;
+}
+
+/**
+ * fpga_region_core_request_init - initialize a request for a region
+ * @request: request
+ * @priority: requests with a higher priority are served first
+ * @timeout_ms: give up after this many milliseconds, 0 to wait forever
+ */
+void fpga_region_core_request_init(struct fpga_region_core_request *request,
+				   int priority, unsigned int timeout_ms)
+{
+	request->priority   = priority;
+	request->timeout_ms = timeout_ms;
+	request->deadline   = 0;
+	request->cancelled  = false;
+	request->acquired   = false;
+	INIT_LIST_HEAD(&request->node);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_request_init);
+
+/**
+ * fpga_region_core_cancel_request - cancel a request waiting for a region
+ * @region: FPGA region
+ * @request: request
+ *
+ * A request that is waiting for the region or the FPGA manager fails with
+ * -ECANCELED.  A request that is already programming is not affected.
+ */
+void fpga_region_core_cancel_request(struct fpga_region_core *region,
+				     struct fpga_region_core_request *request)
+{
+	spin_lock(&region->request_lock);
+	request->cancelled = true;
+	spin_unlock(&region->request_lock);
+
+	wake_up_all(&region->request_wq);
+	wake_up_all(&fpga_region_core_mgr_wq);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_cancel_request);
+
+/*
+ * Release the region mutex and let the request at the head of the queue
+ * take it.  Every unlock of the region mutex goes through here.
+ */
+static void fpga_region_core_unlock(struct fpga_region_core *region)
+{
+	mutex_unlock(&region->mutex);
+	wake_up_all(&region->request_wq);
+}
+
+/*
+ * Wait condition for a queued request: the request is at the head of the
+ * queue and has taken the region mutex, or it has been cancelled.
+ */
+static bool fpga_region_core_request_region_ready(struct fpga_region_core *region,
+						  struct fpga_region_core_request *request)
+{
+	bool ready;
+
+	spin_lock(&region->request_lock);
+	if (request->cancelled)
+		ready = true;
+	else if (list_first_entry(&region->request_queue,
+				  struct fpga_region_core_request, node) != request)
+		ready = false;
+	else
+		ready = request->acquired = mutex_trylock(&region->mutex);
+	spin_unlock(&region->request_lock);
+
+	return ready;
+}
+
+/**
+ * fpga_region_core_mgr_claim - claim the FPGA manager of a region for the core
+ * @region: FPGA region
+ *
+ * Only one region of a FPGA manager can hold the claim at a time.  Unlike
+ * fpga_mgr_lock() this does not log anything when the manager is in use, so
+ * it can be used as a wait condition.
+ *
+ * Return: true if the claim was taken.
+ */
+static bool fpga_region_core_mgr_claim(struct fpga_region_core *region)
+{
+	struct fpga_region_core *pos;
+	bool claimed = true;
+
+	spin_lock(&fpga_region_core_mgr_claim_lock);
+	list_for_each_entry(pos, &fpga_region_core_mgr_claims, mgr_claim_node) {
+		if (pos->mgr == region->mgr) {
+			claimed = false;
+			break;
+		}
+	}
+	if (claimed)
+		list_add_tail(&region->mgr_claim_node, &fpga_region_core_mgr_claims);
+	spin_unlock(&fpga_region_core_mgr_claim_lock);
+
+	return claimed;
+}
+
+static void __fpga_region_core_mgr_unclaim(struct fpga_region_core *region)
+{
+	spin_lock(&fpga_region_core_mgr_claim_lock);
+	list_del_init(&region->mgr_claim_node);
+	spin_unlock(&fpga_region_core_mgr_claim_lock);
+}
+
+/**
+ * fpga_region_core_mgr_unclaim - release the claim on the FPGA manager of a region
+ * @region: FPGA region
+ */
+static void fpga_region_core_mgr_unclaim(struct fpga_region_core *region)
+{
+	__fpga_region_core_mgr_unclaim(region);
+	wake_up_all(&fpga_region_core_mgr_wq);
+}
+
+/**
+ * fpga_region_core_mgr_trylock - claim and lock the FPGA manager of a region
+ * @region: FPGA region
+ *
+ * The manager is claimed within the core first, and only then locked with
+ * fpga_mgr_lock().  That fails only if the manager is used outside of the
+ * core.  The claim is then dropped without waking anyone, since this is
+ * also a wait condition on fpga_region_core_mgr_wq.
+ *
+ * Return: true if the manager was locked.
+ */
+static bool fpga_region_core_mgr_trylock(struct fpga_region_core *region)
+{
+	if (!fpga_region_core_mgr_claim(region))
+		return false;
+
+	if (fpga_mgr_lock(region->mgr)) {
+		__fpga_region_core_mgr_unclaim(region);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Wait condition for a request that holds the region: the request has
+ * locked the FPGA manager, or it has been cancelled.
+ */
+static bool fpga_region_core_request_mgr_ready(struct fpga_region_core *region,
+					       struct fpga_region_core_request *request)
+{
+	if (READ_ONCE(request->cancelled))
+		return true;
+
+	request->acquired = fpga_region_core_mgr_trylock(region);
+
+	return request->acquired;
+}
+
+/**
+ * fpga_region_core_request_wait - sleep until a request is ready
+ * @region: FPGA region
+ * @request: request
+ * @wq: wait queue to sleep on
+ * @ready: wait condition, sets request->acquired when it succeeds
+ * @poll: interval to re-check @ready at without being woken, or
+ *        MAX_SCHEDULE_TIMEOUT
+ *
+ * Return 0 if the request acquired what it was waiting for, -ETIMEDOUT,
+ * -ECANCELED, or -ERESTARTSYS if interrupted by a signal.
+ */
+static int fpga_region_core_request_wait(
+	struct fpga_region_core *region,
+	struct fpga_region_core_request *request,
+	wait_queue_head_t *wq,
+	bool (*ready)(struct fpga_region_core *, struct fpga_region_core_request *),
+	long poll)
+{
+	long timeout;
+	long ret;
+
+	request->acquired = false;
+
+	for (;;) {
+		timeout = poll;
+		if (request->timeout_ms) {
+			if (time_after_eq(jiffies, request->deadline))
+				return -ETIMEDOUT;
+			timeout = min_t(long, timeout, request->deadline - jiffies);
+		}
+
+		ret = wait_event_interruptible_timeout(*wq, ready(region, request),
+						       timeout);
+		if (ret < 0)
+			return ret;
+		if (ret > 0)
+			return request->acquired ? 0 : -ECANCELED;
+	}
+}
+
+/**
+ * fpga_region_core_request_lock - take the region mutex through the request queue
+ * @region: FPGA region
+ * @request: request
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_request_lock(struct fpga_region_core *region,
+					 struct fpga_region_core_request *request)
+{
+	struct fpga_region_core_request *pos;
+	int ret;
+
+	if (request->timeout_ms)
+		request->deadline = jiffies + msecs_to_jiffies(request->timeout_ms);
+
+	/* Insert behind every request of the same or a higher priority. */
+	spin_lock(&region->request_lock);
+	list_for_each_entry(pos, &region->request_queue, node) {
+		if (pos->priority < request->priority)
+			break;
+	}
+	list_add_tail(&request->node, &pos->node);
+	spin_unlock(&region->request_lock);
+
+	ret = fpga_region_core_request_wait(region, request, &region->request_wq,
+					    fpga_region_core_request_region_ready,
+					    MAX_SCHEDULE_TIMEOUT);
+
+	spin_lock(&region->request_lock);
+	list_del_init(&request->node);
+	spin_unlock(&region->request_lock);
+
+	/* Let the next request in the queue become the head. */
+	wake_up_all(&region->request_wq);
+
+	return ret;
+}
+
+/**
+ * fpga_region_core_get - get an exclusive reference to a fpga region core
+ * @region: FPGA Region struct
+ * @request: request to wait in the queue with, or NULL not to wait
+ *
+ * Caller should call fpga_region_core_put() when done with region.
+ *
+ * Return fpga_region struct if successful.
+ * Return -EBUSY if someone already has a reference to the region and
+ * @request is NULL, or the error code of a queued request that failed.
+ * Return -ENODEV if @np is not a FPGA Region.
+ */
+static struct fpga_region_core *fpga_region_core_get(struct fpga_region_core *region,
+						     struct fpga_region_core_request *request)
+{
+	struct device *dev = &region->dev;
+	int ret;
+
+	if (request) {
+		ret = fpga_region_core_request_lock(region, request);
+		if (ret) {
+			dev_dbg(dev, "%s: queued request failed (%d)\n", __func__, ret);
+			return ERR_PTR(ret);
+		}
+	} else if (!mutex_trylock(&region->mutex)) {
+		dev_dbg(dev, "%s: FPGA Region already in use\n", __func__);
+		return ERR_PTR(-EBUSY);
+	}
+
+	get_device(dev);
+	if (!try_module_get(dev->parent->driver->owner)) {
+		put_device(dev);
+		fpga_region_core_unlock(region);
+		return ERR_PTR(-ENODEV);
+	}
+
+	dev_dbg(dev, "get\n");
+
+	return region;
+}
+
+/**
+ * fpga_region_core_put - release a reference to a region
+ *
+ * @region: FPGA region
+ */
+static void fpga_region_core_put(struct fpga_region_core *region)
+{
+	struct device *dev = &region->dev;
+
+	dev_dbg(dev, "put\n");
+
+	module_put(dev->parent->driver->owner);
+	put_device(dev);
+	fpga_region_core_unlock(region);
+}
+
+/**
+ * fpga_region_core_mgr_lock - lock the FPGA manager of a region
+ * @region: FPGA region
+ * @request: request to wait with, or NULL not to wait
+ *
+ * See fpga_region_core_mgr_trylock().  With @request, the request waits
+ * until another region of the core releases the manager, and retries a
+ * manager used outside of the core every FPGA_REGION_CORE_MGR_POLL.
+ *
+ * Return 0 for success, -EBUSY if the manager is in use and @request is
+ * NULL, or the error code of a queued request that failed.
+ */
+static int fpga_region_core_mgr_lock(struct fpga_region_core *region,
+				     struct fpga_region_core_request *request)
+{
+	if (!request)
+		return fpga_region_core_mgr_trylock(region) ? 0 : -EBUSY;
+
+	return fpga_region_core_request_wait(region, request,
+					     &fpga_region_core_mgr_wq,
+					     fpga_region_core_request_mgr_ready,
+					     FPGA_REGION_CORE_MGR_POLL);
+}
+
+/**
+ * fpga_region_core_mgr_unlock - unlock the FPGA manager of a region
+ * @region: FPGA region
+ */
+static void fpga_region_core_mgr_unlock(struct fpga_region_core *region)
+{
+	fpga_mgr_unlock(region->mgr);
+	fpga_region_core_mgr_unclaim(region);
+}
+
+/*
+ * Image digests
+ *
+ * The transform is looked up by the generic "sha256" name, so the crypto
+ * API picks the implementation with the highest priority, which is the SIMD
+ * accelerated one on CPUs that have it.
+ */
+#define FPGA_REGION_CORE_DIGEST_STEP	(1024 * 1024)
+
+static struct crypto_shash *fpga_region_core_digest_tfm;
+static DEFINE_MUTEX(fpga_region_core_digest_lock);
+
+/**
+ * fpga_region_core_digest_begin - start computing an image digest
+ *
+ * The transform is allocated on first use.
+ *
+ * Return: hash descriptor, or NULL if no digest can be computed.
+ */
+static struct shash_desc *fpga_region_core_digest_begin(void)
+{
+	struct crypto_shash *tfm;
+	struct shash_desc *desc;
+
+	mutex_lock(&fpga_region_core_digest_lock);
+	tfm = fpga_region_core_digest_tfm;
+	if (!tfm) {
+		tfm = crypto_alloc_shash("sha256", 0, 0);
+		if (IS_ERR(tfm)) {
+			mutex_unlock(&fpga_region_core_digest_lock);
+			return NULL;
+		}
+		pr_debug("%s: using %s\n", __func__,
+			 crypto_tfm_alg_driver_name(crypto_shash_tfm(tfm)));
+		fpga_region_core_digest_tfm = tfm;
+	}
+	mutex_unlock(&fpga_region_core_digest_lock);
+
+	desc = kmalloc(sizeof(*desc) + crypto_shash_descsize(tfm), GFP_KERNEL);
+	if (!desc)
+		return NULL;
+
+	desc->tfm = tfm;
+	if (crypto_shash_init(desc)) {
+		kfree(desc);
+		return NULL;
+	}
+
+	return desc;
+}
+
+/**
+ * fpga_region_core_digest_update - add data to an image digest
+ * @desc: hash descriptor
+ * @buf: data
+ * @size: size of @buf
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_digest_update(struct shash_desc *desc,
+					  const void *buf, size_t size)
+{
+	size_t len;
+	int ret;
+
+	while (size) {
+		len = min_t(size_t, size, FPGA_REGION_CORE_DIGEST_STEP);
+		ret = crypto_shash_update(desc, buf, len);
+		if (ret)
+			return ret;
+		buf  += len;
+		size -= len;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/**
+ * fpga_region_core_digest_end - finish an image digest
+ * @desc: hash descriptor, freed here
+ * @digest: digest to set
+ * @size: number of bytes hashed
+ */
+static void fpga_region_core_digest_end(struct shash_desc *desc,
+					struct fpga_region_core_digest *digest,
+					u64 size)
+{
+	digest->valid = !crypto_shash_final(desc, digest->value);
+	digest->size  = size;
+	kfree(desc);
+}
+
+/**
+ * fpga_region_core_digest_buf - compute the digest of an image in memory
+ * @digest: digest to set; left invalid if it can't be computed
+ * @buf: image
+ * @size: size of @buf
+ */
+static void fpga_region_core_digest_buf(struct fpga_region_core_digest *digest,
+					const void *buf, size_t size)
+{
+	struct shash_desc *desc;
+
+	digest->valid = false;
+
+	desc = fpga_region_core_digest_begin();
+	if (!desc)
+		return;
+
+	if (fpga_region_core_digest_update(desc, buf, size)) {
+		kfree(desc);
+		return;
+	}
+
+	fpga_region_core_digest_end(desc, digest, size);
+}
+
+/**
+ * fpga_region_core_digest_sgt - compute the digest of an image in an sg table
+ * @digest: digest to set; left invalid if it can't be computed
+ * @sgt: image, in pages the CPU can map
+ */
+static void fpga_region_core_digest_sgt(struct fpga_region_core_digest *digest,
+					struct sg_table *sgt)
+{
+	struct sg_mapping_iter miter;
+	struct shash_desc *desc;
+	u64 size = 0;
+	int ret = 0;
+
+	digest->valid = false;
+
+	desc = fpga_region_core_digest_begin();
+	if (!desc)
+		return;
+
+	sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+	while (!ret && sg_miter_next(&miter)) {
+		ret = crypto_shash_update(desc, miter.addr, miter.length);
+		size += miter.length;
+	}
+	sg_miter_stop(&miter);
+
+	if (ret) {
+		kfree(desc);
+		return;
+	}
+
+	fpga_region_core_digest_end(desc, digest, size);
+}
+
+/**
+ * struct fpga_region_core_cache_entry - cached FPGA image
+ * @node: entry in fpga_region_core_cache.lru
+ * @name: firmware name
+ * @fw: firmware returned by request_firmware()
+ * @digest: digest of @fw
+ * @users: number of regions currently using @fw
+ * @cached: entry is on the LRU list
+ */
+struct fpga_region_core_cache_entry {
+	struct list_head node;
+	const char *name;
+	const struct firmware *fw;
+	struct fpga_region_core_digest digest;
+	unsigned int users;
+	bool cached;
+};
+
+/**
+ * struct fpga_region_core_cache - FPGA image cache
+ * @lock: protects all members
+ * @lru: cached entries, most recently used first
+ * @entries: number of entries on @lru
+ * @bytes: total size of the images on @lru
+ * @hits: lookups served from the cache
+ * @misses: lookups that had to read the firmware
+ * @evictions: entries dropped because of limits, memory pressure or a flush
+ * @generation: incremented by each flush, so that an image read before a
+ *              flush is not cached after it
+ */
+static struct fpga_region_core_cache {
+	struct mutex lock;
+	struct list_head lru;
+	unsigned int entries;
+	size_t bytes;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long generation;
+} fpga_region_core_cache = {
+	.lock = __MUTEX_INITIALIZER(fpga_region_core_cache.lock),
+	.lru  = LIST_HEAD_INIT(fpga_region_core_cache.lru),
+};
+
+static unsigned long fpga_region_core_cache_pages(struct fpga_region_core_cache_entry *entry)
+{
+	return DIV_ROUND_UP(entry->fw->size, PAGE_SIZE);
+}
+
+static void fpga_region_core_cache_free(struct fpga_region_core_cache_entry *entry)
+{
+	release_firmware(entry->fw);
+	kfree(entry->name);
+	kfree(entry);
+}
+
+/*
+ * Take an entry off the LRU list.  Called with fpga_region_core_cache.lock
+ * held.  Returns true if the entry is idle and may be freed by the caller.
+ */
+static bool __fpga_region_core_cache_remove(struct fpga_region_core_cache_entry *entry)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+
+	list_del_init(&entry->node);
+	entry->cached = false;
+	cache->entries--;
+	cache->bytes -= entry->fw->size;
+	cache->evictions++;
+
+	return !entry->users;
+}
+
+/*
+ * Evict idle entries from the tail of the LRU list until the cache fits in
+ * its limits.  Called with fpga_region_core_cache.lock held; the evicted
+ * entries are moved to @dispose and must be freed after unlocking.
+ */
+static void __fpga_region_core_cache_trim(struct list_head *dispose)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	struct fpga_region_core_cache_entry *entry, *next;
+
+	list_for_each_entry_safe_reverse(entry, next, &cache->lru, node) {
+		if (cache->entries <= cache_max_entries &&
+		    cache->bytes   <= cache_max_bytes)
+			break;
+		if (entry->users)
+			continue;
+		__fpga_region_core_cache_remove(entry);
+		list_add(&entry->node, dispose);
+	}
+}
+
+static void fpga_region_core_cache_dispose(struct list_head *dispose)
+{
+	struct fpga_region_core_cache_entry *entry, *next;
+
+	list_for_each_entry_safe(entry, next, dispose, node) {
+		list_del(&entry->node);
+		fpga_region_core_cache_free(entry);
+	}
+}
+
+/*
+ * Find the cached entry of a firmware name.  Called with
+ * fpga_region_core_cache.lock held.
+ */
+static struct fpga_region_core_cache_entry *fpga_region_core_cache_lookup(const char *name)
+{
+	struct fpga_region_core_cache_entry *entry;
+
+	list_for_each_entry(entry, &fpga_region_core_cache.lru, node) {
+		if (!strcmp(entry->name, name))
+			return entry;
+	}
+	return NULL;
+}
+
+/**
+ * fpga_region_core_cache_get - get a FPGA image from the cache
+ * @name: firmware name
+ * @dev: device for request_firmware()
+ *
+ * Entries are keyed by @name alone, so where the firmware loader finds the
+ * file does not matter.  On a hit no image data is read at all.  A file
+ * that is replaced while its image is cached is not noticed; it is read
+ * again after fpga_region_core_cache_flush(), see the cache_flush class
+ * attribute.  If the cache is disabled, the firmware is read as usual and
+ * dropped again when the caller puts the entry.
+ *
+ * Caller should call fpga_region_core_cache_put() when done with the entry.
+ *
+ * Return: cache entry or IS_ERR() condition containing error code.
+ */
+static struct fpga_region_core_cache_entry *fpga_region_core_cache_get(
+	const char *name, struct device *dev)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	struct fpga_region_core_cache_entry *entry;
+	unsigned long generation = 0;
+	bool cacheable = cache_max_entries;
+	LIST_HEAD(dispose);
+	int ret;
+
+	if (cacheable) {
+		mutex_lock(&cache->lock);
+		entry = fpga_region_core_cache_lookup(name);
+		if (entry) {
+			entry->users++;
+			list_move(&entry->node, &cache->lru);
+			cache->hits++;
+			mutex_unlock(&cache->lock);
+			return entry;
+		}
+		cache->misses++;
+		generation = cache->generation;
+		mutex_unlock(&cache->lock);
+	}
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&entry->node);
+	entry->users = 1;
+	entry->name  = kstrdup(name, GFP_KERNEL);
+	if (!entry->name) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = request_firmware(&entry->fw, name, dev);
+	if (ret) {
+		dev_err(dev, "Error requesting firmware %s\n", name);
+		goto err_free_name;
+	}
+
+	fpga_region_core_digest_buf(&entry->digest, entry->fw->data, entry->fw->size);
+
+	if (!cacheable)
+		return entry;
+
+	mutex_lock(&cache->lock);
+	/* Don't cache an image read before a flush, or read twice at once. */
+	if (cache->generation != generation ||
+	    fpga_region_core_cache_lookup(name)) {
+		mutex_unlock(&cache->lock);
+		return entry;
+	}
+	list_add(&entry->node, &cache->lru);
+	entry->cached = true;
+	cache->entries++;
+	cache->bytes += entry->fw->size;
+	__fpga_region_core_cache_trim(&dispose);
+	mutex_unlock(&cache->lock);
+	fpga_region_core_cache_dispose(&dispose);
+
+	return entry;
+
+err_free_name:
+	kfree(entry->name);
+err_free:
+	kfree(entry);
+
+	return ERR_PTR(ret);
+}
+
+/**
+ * fpga_region_core_cache_put - release a FPGA image got from the cache
+ * @entry: cache entry
+ */
+static void fpga_region_core_cache_put(struct fpga_region_core_cache_entry *entry)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	LIST_HEAD(dispose);
+	bool idle;
+
+	mutex_lock(&cache->lock);
+	idle = !--entry->users && !entry->cached;
+	__fpga_region_core_cache_trim(&dispose);
+	mutex_unlock(&cache->lock);
+
+	if (idle)
+		fpga_region_core_cache_free(entry);
+	fpga_region_core_cache_dispose(&dispose);
+}
+
+static unsigned long fpga_region_core_cache_count(struct shrinker *shrink,
+						  struct shrink_control *sc)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	struct fpga_region_core_cache_entry *entry;
+	unsigned long count = 0;
+
+	if (!mutex_trylock(&cache->lock))
+		return 0;
+
+	list_for_each_entry(entry, &cache->lru, node) {
+		if (!entry->users)
+			count += fpga_region_core_cache_pages(entry);
+	}
+	mutex_unlock(&cache->lock);
+
+	return count;
+}
+
+static unsigned long fpga_region_core_cache_scan(struct shrinker *shrink,
+						 struct shrink_control *sc)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	struct fpga_region_core_cache_entry *entry, *next;
+	unsigned long freed = 0;
+	LIST_HEAD(dispose);
+
+	if (!mutex_trylock(&cache->lock))
+		return SHRINK_STOP;
+
+	list_for_each_entry_safe_reverse(entry, next, &cache->lru, node) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		if (entry->users)
+			continue;
+		freed += fpga_region_core_cache_pages(entry);
+		__fpga_region_core_cache_remove(entry);
+		list_add(&entry->node, &dispose);
+	}
+	mutex_unlock(&cache->lock);
+
+	fpga_region_core_cache_dispose(&dispose);
+
+	return freed;
+}
+
+static struct shrinker fpga_region_core_cache_shrinker = {
+	.count_objects = fpga_region_core_cache_count,
+	.scan_objects  = fpga_region_core_cache_scan,
+	.seeks         = DEFAULT_SEEKS,
+};
+
+/**
+ * fpga_region_core_cache_flush - drop cached FPGA images
+ * @name: firmware name of the image to drop, or NULL to drop every image
+ *
+ * The next request of a dropped image reads its file again.  Images in use
+ * are freed when their last user puts them.
+ */
+static void fpga_region_core_cache_flush(const char *name)
+{
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;
+	struct fpga_region_core_cache_entry *entry, *next;
+	LIST_HEAD(dispose);
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(entry, next, &cache->lru, node) {
+		if (name && strcmp(entry->name, name))
+			continue;
+		if (__fpga_region_core_cache_remove(entry))
+			list_add(&entry->node, &dispose);
+	}
+	cache->generation++;
+	mutex_unlock(&cache->lock);
+
+	fpga_region_core_cache_dispose(&dispose);
+}
+
+/**
+ * enum fpga_region_core_format - format of a FPGA image file
+ * @FPGA_REGION_CORE_FORMAT_RAW: uncompressed
+ * @FPGA_REGION_CORE_FORMAT_GZIP: gzip compressed
+ * @FPGA_REGION_CORE_FORMAT_ZSTD: zstd compressed
+ */
+enum fpga_region_core_format {
+	FPGA_REGION_CORE_FORMAT_RAW,
+	FPGA_REGION_CORE_FORMAT_GZIP,
+	FPGA_REGION_CORE_FORMAT_ZSTD,
+};
+
+/* Largest zstd window accepted, which bounds the decompressor workspace */
+#define FPGA_REGION_CORE_ZSTD_WINDOW_MAX	(8 * 1024 * 1024)
+
+/**
+ * struct fpga_region_core_decomp - decompressor of a compressed FPGA image
+ * @format: format of the image
+ * @workspace: workspace of the decompressor
+ * @zlib: inflate stream, for FPGA_REGION_CORE_FORMAT_GZIP
+ * @zstd: zstd stream, for FPGA_REGION_CORE_FORMAT_ZSTD
+ * @crc: CRC32 of the gzip output so far, before the final inversion
+ * @inflated: the deflate data of a gzip image has ended
+ * @trailer: gzip trailer, CRC32 and ISIZE of the uncompressed data
+ * @trailer_len: number of bytes in @trailer
+ * @end: the end of the compressed data has been reached, and for gzip the
+ *       trailer has been checked
+ * @size_hint: size of the uncompressed image given by the gzip trailer or
+ *             the zstd frame header, or 0 if it is not known
+ */
+struct fpga_region_core_decomp {
+	enum fpga_region_core_format format;
+	void *workspace;
+	z_stream zlib;
+	ZSTD_DStream *zstd;
+	u32 crc;
+	bool inflated;
+	u8 trailer[8];
+	size_t trailer_len;
+	bool end;
+	size_t size_hint;
+};
+
+/*
+ * Decompression statistics, exported as class attributes.  Throughput is
+ * out_bytes / usecs.
+ */
+static struct fpga_region_core_decomp_stats {
+	atomic64_t in_bytes;
+	atomic64_t out_bytes;
+	atomic64_t usecs;
+} fpga_region_core_decomp_stats;
+
+static bool fpga_region_core_has_suffix(const char *name, const char *suffix)
+{
+	size_t name_len   = strlen(name);
+	size_t suffix_len = strlen(suffix);
+
+	return name_len >= suffix_len &&
+	       !strcmp(name + name_len - suffix_len, suffix);
+}
+
+/**
+ * fpga_region_core_image_format - detect the format of a FPGA image
+ * @name: firmware name
+ * @head: first bytes of the image
+ * @size: number of bytes at @head
+ *
+ * The ".gz" and ".zst" suffixes of @name take precedence over the magic
+ * number at @head.
+ */
+static enum fpga_region_core_format fpga_region_core_image_format(
+	const char *name, const u8 *head, size_t size)
+{
+	if (fpga_region_core_has_suffix(name, ".gz"))
+		return FPGA_REGION_CORE_FORMAT_GZIP;
+	if (fpga_region_core_has_suffix(name, ".zst"))
+		return FPGA_REGION_CORE_FORMAT_ZSTD;
+	if (size >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+		return FPGA_REGION_CORE_FORMAT_GZIP;
+	if (size >= 4 && get_unaligned_le32(head) == 0xfd2fb528)
+		return FPGA_REGION_CORE_FORMAT_ZSTD;
+
+	return FPGA_REGION_CORE_FORMAT_RAW;
+}
+
+/**
+ * fpga_region_core_gzip_header - get the size of a gzip member header
+ * @buf: start of the gzip data
+ * @size: number of bytes at @buf
+ *
+ * The kernel inflate does not parse gzip headers, so the header is skipped
+ * here and the deflate data after it is inflated raw.
+ *
+ * Return the header size or -EINVAL.
+ */
+static int fpga_region_core_gzip_header(const u8 *buf, size_t size)
+{
+	size_t pos = 10;
+	u8 flags;
+
+	if (size < pos || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8)
+		return -EINVAL;
+
+	flags = buf[3];
+	if (flags & 0xe0)
+		return -EINVAL;
+	if (flags & 0x04) {		/* FEXTRA */
+		if (pos + 2 > size)
+			return -EINVAL;
+		pos += 2 + get_unaligned_le16(buf + pos);
+	}
+	if (flags & 0x08) {		/* FNAME */
+		while (pos < size && buf[pos])
+			pos++;
+		pos++;
+	}
+	if (flags & 0x10) {		/* FCOMMENT */
+		while (pos < size && buf[pos])
+			pos++;
+		pos++;
+	}
+	if (flags & 0x02)		/* FHCRC */
+		pos += 2;
+
+	return (pos <= size) ? pos : -EINVAL;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0))
+static int fpga_region_core_zstd_init(struct fpga_region_core_decomp *decomp,
+				      const void *head, size_t size)
+{
+	zstd_frame_header header;
+	size_t workspace_size;
+
+	if (zstd_get_frame_header(&header, head, size))
+		return -EINVAL;
+	if (header.windowSize > FPGA_REGION_CORE_ZSTD_WINDOW_MAX)
+		return -E2BIG;
+	if (header.frameContentSize != ZSTD_CONTENTSIZE_UNKNOWN &&
+	    header.frameContentSize <= SIZE_MAX)
+		decomp->size_hint = header.frameContentSize;
+
+	workspace_size = zstd_dstream_workspace_bound(header.windowSize);
+	decomp->workspace = vmalloc(workspace_size);
+	if (!decomp->workspace)
+		return -ENOMEM;
+
+	decomp->zstd = zstd_init_dstream(header.windowSize, decomp->workspace,
+					 workspace_size);
+
+	return (decomp->zstd) ? 0 : -EINVAL;
+}
+
+static int fpga_region_core_zstd_run(struct fpga_region_core_decomp *decomp,
+				     ZSTD_inBuffer *in, ZSTD_outBuffer *out)
+{
+	size_t ret = zstd_decompress_stream(decomp->zstd, out, in);
+
+	if (zstd_is_error(ret))
+		return -EINVAL;
+	if (ret == 0)
+		decomp->end = true;
+
+	return 0;
+}
+#else
+static int fpga_region_core_zstd_init(struct fpga_region_core_decomp *decomp,
+				      const void *head, size_t size)
+{
+	ZSTD_frameParams params;
+	size_t workspace_size;
+
+	if (ZSTD_getFrameParams(&params, head, size))
+		return -EINVAL;
+	if (params.windowSize > FPGA_REGION_CORE_ZSTD_WINDOW_MAX)
+		return -E2BIG;
+	if (params.frameContentSize <= SIZE_MAX)
+		decomp->size_hint = params.frameContentSize;
+
+	workspace_size = ZSTD_DStreamWorkspaceBound(params.windowSize);
+	decomp->workspace = vmalloc(workspace_size);
+	if (!decomp->workspace)
+		return -ENOMEM;
+
+	decomp->zstd = ZSTD_initDStream(params.windowSize, decomp->workspace,
+					workspace_size);
+
+	return (decomp->zstd) ? 0 : -EINVAL;
+}
+
+static int fpga_region_core_zstd_run(struct fpga_region_core_decomp *decomp,
+				     ZSTD_inBuffer *in, ZSTD_outBuffer *out)
+{
+	size_t ret = ZSTD_decompressStream(decomp->zstd, out, in);
+
+	if (ZSTD_isError(ret))
+		return -EINVAL;
+	if (ret == 0)
+		decomp->end = true;
+
+	return 0;
+}
+#endif
+
+static void fpga_region_core_decomp_free(struct fpga_region_core_decomp *decomp)
+{
+	vfree(decomp->workspace);
+	decomp->workspace = NULL;
+}
+
+/**
+ * fpga_region_core_decomp_init - start decompressing a FPGA image
+ * @decomp: decompressor
+ * @format: format of the image
+ * @head: the compressed image
+ * @size: size of @head
+ *
+ * Return the number of header bytes at @head the decompressor does not
+ * want to see, or negative error code.
+ */
+static int fpga_region_core_decomp_init(struct fpga_region_core_decomp *decomp,
+					enum fpga_region_core_format format,
+					const void *head, size_t size)
+{
+	int skip;
+	int ret;
+
+	memset(decomp, 0, sizeof(*decomp));
+	decomp->format = format;
+
+	switch (format) {
+	case FPGA_REGION_CORE_FORMAT_GZIP:
+		if (!IS_ENABLED(CONFIG_ZLIB_INFLATE))
+			return -EOPNOTSUPP;
+		skip = fpga_region_core_gzip_header(head, size);
+		if (skip < 0)
+			return skip;
+		decomp->workspace = vmalloc(zlib_inflate_workspacesize());
+		if (!decomp->workspace)
+			return -ENOMEM;
+		decomp->zlib.workspace = decomp->workspace;
+		decomp->crc = ~0;
+		/* ISIZE is the size modulo 2^32, and deflate expands at most 1032:1. */
+		if (size >= skip + 8 && (size - skip) <= SIZE_MAX / 1032) {
+			u32 isize = get_unaligned_le32(head + size - 4);
+
+			if (isize <= (size - skip) * 1032)
+				decomp->size_hint = isize;
+		}
+		if (zlib_inflateInit2(&decomp->zlib, -MAX_WBITS) != Z_OK) {
+			fpga_region_core_decomp_free(decomp);
+			return -EINVAL;
+		}
+		return skip;
+
+	case FPGA_REGION_CORE_FORMAT_ZSTD:
+		if (!IS_ENABLED(CONFIG_ZSTD_DECOMPRESS))
+			return -EOPNOTSUPP;
+		ret = fpga_region_core_zstd_init(decomp, head, size);
+		if (ret)
+			fpga_region_core_decomp_free(decomp);
+		return ret;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * fpga_region_core_decomp_run - decompress a piece of a FPGA image
+ * @decomp: decompressor
+ * @in: compressed input
+ * @in_size: size of @in
+ * @in_pos: position in @in, advanced past the consumed input
+ * @out: output buffer
+ * @out_size: size of @out
+ * @out_pos: position in @out, advanced past the produced output
+ *
+ * Runs until @in is used up, @out is full, or the end of the compressed
+ * data is reached.  The end of a gzip image is only reported once the CRC32
+ * and the size in its trailer match the output.
+ *
+ * Return 0 for success, -EINVAL if the data is corrupt.
+ */
+static int fpga_region_core_decomp_run(struct fpga_region_core_decomp *decomp,
+				       const void *in, size_t in_size, size_t *in_pos,
+				       void *out, size_t out_size, size_t *out_pos)
+{
+	size_t in_start  = *in_pos;
+	size_t out_start = *out_pos;
+	ktime_t start = ktime_get();
+	int ret = 0;
+
+	if (decomp->format == FPGA_REGION_CORE_FORMAT_GZIP && !decomp->inflated) {
+		decomp->zlib.next_in   = in + *in_pos;
+		decomp->zlib.avail_in  = in_size - *in_pos;
+		decomp->zlib.next_out  = out + *out_pos;
+		decomp->zlib.avail_out = out_size - *out_pos;
+		switch (zlib_inflate(&decomp->zlib, Z_SYNC_FLUSH)) {
+		case Z_STREAM_END:
+			decomp->inflated = true;
+			break;
+		case Z_OK:
+		case Z_BUF_ERROR:
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		*in_pos  = in_size  - decomp->zlib.avail_in;
+		*out_pos = out_size - decomp->zlib.avail_out;
+		decomp->crc = crc32_le(decomp->crc, out + out_start, *out_pos - out_start);
+	}
+
+	if (decomp->format == FPGA_REGION_CORE_FORMAT_GZIP && decomp->inflated && !ret) {
+		size_t len = min(sizeof(decomp->trailer) - decomp->trailer_len,
+				 in_size - *in_pos);
+
+		memcpy(decomp->trailer + decomp->trailer_len, in + *in_pos, len);
+		decomp->trailer_len += len;
+		*in_pos += len;
+
+		if (decomp->trailer_len == sizeof(decomp->trailer)) {
+			if (get_unaligned_le32(decomp->trailer) != ~decomp->crc ||
+			    get_unaligned_le32(decomp->trailer + 4) != (u32)decomp->zlib.total_out)
+				ret = -EINVAL;
+			else
+				decomp->end = true;
+		}
+	} else if (decomp->format != FPGA_REGION_CORE_FORMAT_GZIP) {
+		ZSTD_inBuffer  zin  = { .src = in,  .size = in_size,  .pos = *in_pos  };
+		ZSTD_outBuffer zout = { .dst = out, .size = out_size, .pos = *out_pos };
+
+		ret = fpga_region_core_zstd_run(decomp, &zin, &zout);
+		*in_pos  = zin.pos;
+		*out_pos = zout.pos;
+	}
+
+	/* Neither input consumed nor output produced: the data is corrupt. */
+	if (!ret && !decomp->end && *in_pos == in_start && *out_pos == out_start)
+		ret = -EINVAL;
+
+	atomic64_add(*in_pos - in_start, &fpga_region_core_decomp_stats.in_bytes);
+	atomic64_add(*out_pos - out_start, &fpga_region_core_decomp_stats.out_bytes);
+	atomic64_add(ktime_us_delta(ktime_get(), start), &fpga_region_core_decomp_stats.usecs);
+
+	return ret;
+}
+
+/**
+ * fpga_region_core_image_decompress - decompress a whole FPGA image
+ * @region: FPGA region
+ * @format: format of the image
+ * @data: compressed image
+ * @size: size of @data
+ *
+ * The image is decompressed into region->image.decompressed.  When the
+ * gzip trailer or the zstd frame header gives the uncompressed size, the
+ * buffer is allocated at that size once, so only the compressed and the
+ * uncompressed image are in memory.  Otherwise it starts at four times the
+ * compressed size and doubles as needed, which briefly holds the old and
+ * the new buffer while the output is copied.
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_image_decompress(struct fpga_region_core *region,
+					     enum fpga_region_core_format format,
+					     const void *data, size_t size)
+{
+	struct fpga_region_core_image *image = &region->image;
+	struct fpga_region_core_decomp decomp;
+	size_t buf_size = round_up(size * 4, PAGE_SIZE);
+	size_t in_pos;
+	size_t out_pos = 0;
+	void *buf = NULL;
+	int ret;
+
+	ret = fpga_region_core_decomp_init(&decomp, format, data, size);
+	if (ret < 0)
+		return ret;
+	in_pos = ret;
+
+	if (decomp.size_hint) {
+		buf = kvmalloc(round_up(decomp.size_hint, PAGE_SIZE), GFP_KERNEL);
+		if (buf)
+			buf_size = round_up(decomp.size_hint, PAGE_SIZE);
+	}
+	if (!buf)
+		buf = kvmalloc(buf_size, GFP_KERNEL);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (!decomp.end) {
+		/* The gzip trailer is read without room for output. */
+		if (out_pos == buf_size && !decomp.inflated) {
+			void *new_buf = kvmalloc(buf_size * 2, GFP_KERNEL);
+
+			if (!new_buf) {
+				ret = -ENOMEM;
+				goto err_free;
+			}
+			memcpy(new_buf, buf, out_pos);
+			kvfree(buf);
+			buf = new_buf;
+			buf_size *= 2;
+		}
+
+		/* Once the input is used up, no progress means truncated data. */
+		ret = fpga_region_core_decomp_run(&decomp, data, size, &in_pos,
+						  buf, buf_size, &out_pos);
+		if (ret)
+			goto err_free;
+	}
+
+	if (!out_pos) {
+		ret = -EINVAL;
+		goto err_free;
+	}
+
+	image->decompressed      = buf;
+	image->decompressed_size = out_pos;
+	ret = 0;
+	goto out;
+
+err_free:
+	kvfree(buf);
+out:
+	fpga_region_core_decomp_free(&decomp);
+	return ret;
+}
+
+/**
+ * fpga_region_core_image_load - write the prepared image to the manager
+ * @region: FPGA region
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_image_load(struct fpga_region_core *region)
+{
+	return fpga_mgr_load(region->mgr, region->info);
+}
+
+/**
+ * fpga_region_core_image_map - make a fetched image loadable by the manager
+ * @region: FPGA region
+ * @buf: image buffer
+ * @count: size of @buf
+ *
+ * If the manager uses write_sg, build the scatter-gather table here the same
+ * way fpga_mgr_buf_load() would, so that fpga_mgr_load() only has to write it.
+ * Otherwise hand the contiguous buffer to the manager as it is.
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_image_map(struct fpga_region_core *region,
+				      const void *buf, size_t count)
+{
+	struct fpga_region_core_image *image = &region->image;
+	struct fpga_image_info *info = region->info;
+	struct page **pages;
+	const void *p;
+	int nr_pages;
+	int index;
+	int ret;
+
+	if (!region->mgr->mops->write_sg) {
+		info->buf   = buf;
+		info->count = count;
+		return 0;
+	}
+
+	nr_pages = DIV_ROUND_UP((unsigned long)buf + count, PAGE_SIZE) -
+		   (unsigned long)buf / PAGE_SIZE;
+	pages = kmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	p = buf - offset_in_page(buf);
+	for (index = 0; index < nr_pages; index++) {
+		if (is_vmalloc_addr(p))
+			pages[index] = vmalloc_to_page(p);
+		else
+			pages[index] = kmap_to_page((void *)p);
+		if (!pages[index]) {
+			kfree(pages);
+			return -EFAULT;
+		}
+		p += PAGE_SIZE;
+	}
+
+	ret = sg_alloc_table_from_pages(&image->sgt, pages, index,
+					offset_in_page(buf), count, GFP_KERNEL);
+	kfree(pages);
+	if (ret)
+		return ret;
+
+	image->sgt_valid = true;
+	info->sgt = &image->sgt;
+
+	return 0;
+}
+
+/**
+ * fpga_region_core_image_release - release the image fetched by the prepare phase
+ * @region: FPGA region
+ */
+static void fpga_region_core_image_release(struct fpga_region_core *region)
+{
+	struct fpga_region_core_image *image = &region->image;
+	struct fpga_image_info *info = region->info;
+
+	if (image->sgt_valid) {
+		sg_free_table(&image->sgt);
+		image->sgt_valid = false;
+	}
+
+	if (image->staged) {
+		if (region->staged.vaddr)
+			dma_buf_end_cpu_access(region->staged.dmabuf, DMA_FROM_DEVICE);
+		info->sgt    = NULL;
+		info->buf    = NULL;
+		info->count  = 0;
+		info->flags |= FPGA_MGR_CONFIG_DMA_BUF;
+		image->staged = false;
+	}
+
+	if (image->entry) {
+		info->sgt   = NULL;
+		info->buf   = NULL;
+		info->count = 0;
+		fpga_region_core_cache_put(image->entry);
+		image->entry = NULL;
+	}
+
+	if (image->decompressed) {
+		kvfree(image->decompressed);
+		image->decompressed      = NULL;
+		image->decompressed_size = 0;
+	}
+
+	image->digest.valid = false;
+}
+
+/**
+ * fpga_region_core_image_prepare - fetch and validate the FPGA image
+ * @region: FPGA region
+ *
+ * Get the image named by region->info->firmware_name from the image cache,
+ * check its size and map it for the manager.  This runs while the old design is still running,
+ * so the region interfaces only have to be disabled for the configuration
+ * write itself.  Images supplied as a buffer or sg table by the caller, and
+ * images that the manager fetches on its own, are left untouched.
+ *
+ * The digest of the image is computed where the CPU can read the image:
+ * firmware files, buffers supplied by the caller and staged images.
+ *
+ * If FPGA_MGR_CONFIG_DMA_BUF is set and an image has been staged with
+ * fpga_region_core_stage_dmabuf() or fpga_region_core_stage_user(), the
+ * staged image is handed to the manager in place, without a copy: staged
+ * user pages as their sg table, and a staged dma-buf through its kernel
+ * mapping like a buffer, with CPU access to it begun until the image is
+ * released.  FPGA_MGR_CONFIG_DMA_BUF is cleared while the image is loaded,
+ * so that the manager takes the image instead of looking for a buffer of
+ * its own.
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_image_prepare(struct fpga_region_core *region)
+{
+	struct device *dev = &region->dev;
+	struct fpga_region_core_image *image = &region->image;
+	struct fpga_image_info *info = region->info;
+	enum fpga_region_core_format format;
+	const struct firmware *fw;
+	int ret;
+
+	if (info && (info->flags & FPGA_MGR_CONFIG_DMA_BUF) &&
+	    (region->staged.sgt || region->staged.vaddr) &&
+	    !info->sgt && !(info->buf && info->count)) {
+		struct fpga_region_core_staged_image *staged = &region->staged;
+
+		if (staged->vaddr) {
+			ret = dma_buf_begin_cpu_access(staged->dmabuf, DMA_FROM_DEVICE);
+			if (ret)
+				return ret;
+		}
+		info->flags  &= ~FPGA_MGR_CONFIG_DMA_BUF;
+		image->staged = true;
+
+		if (!staged->vaddr) {
+			info->sgt = staged->sgt;
+			fpga_region_core_digest_sgt(&image->digest, info->sgt);
+			return 0;
+		}
+
+		ret = fpga_region_core_image_map(region, staged->vaddr, staged->size);
+		if (ret) {
+			dev_err(dev, "failed to map staged dma-buf\n");
+			goto err_release;
+		}
+		fpga_region_core_digest_buf(&image->digest, staged->vaddr, staged->size);
+		return 0;
+	}
+
+	if (!info || info->sgt)
+		return 0;
+
+	if (info->buf && info->count) {
+		fpga_region_core_digest_buf(&image->digest, info->buf, info->count);
+		return 0;
+	}
+
+	if (!info->firmware_name)
+		return 0;
+
+	if (info->flags & FPGA_MGR_CONFIG_DMA_BUF)
+		return 0;
+
+	image->entry = fpga_region_core_cache_get(info->firmware_name,
+						  &region->mgr->dev);
+	if (IS_ERR(image->entry)) {
+		ret = PTR_ERR(image->entry);
+		image->entry = NULL;
+		return ret;
+	}
+	fw = image->entry->fw;
+	image->digest = image->entry->digest;
+
+	if (!fw->size) {
+		dev_err(dev, "firmware %s is empty\n", info->firmware_name);
+		ret = -EINVAL;
+		goto err_release;
+	}
+
+	format = fpga_region_core_image_format(info->firmware_name, fw->data, fw->size);
+	if (format != FPGA_REGION_CORE_FORMAT_RAW) {
+		ret = fpga_region_core_image_decompress(region, format, fw->data, fw->size);
+		if (ret) {
+			dev_err(dev, "failed to decompress firmware %s\n",
+				info->firmware_name);
+			goto err_release;
+		}
+		ret = fpga_region_core_image_map(region, image->decompressed,
+						 image->decompressed_size);
+	} else {
+		ret = fpga_region_core_image_map(region, fw->data, fw->size);
+	}
+	if (ret) {
+		dev_err(dev, "failed to map firmware %s\n",
+			info->firmware_name);
+		goto err_release;
+	}
+
+	return 0;
+
+err_release:
+	fpga_region_core_image_release(region);
+	return ret;
+}
+
+/*
+ * Staged user pages stay pinned until they are unstaged, and the FPGA
+ * manager may DMA from them, so they are pinned with FOLL_LONGTERM through
+ * pin_user_pages_fast() where the kernel has it.
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0))
+static int fpga_region_core_pin_user_pages(unsigned long start, int nr_pages,
+					   struct page **pages)
+{
+	return pin_user_pages_fast(start, nr_pages, FOLL_LONGTERM, pages);
+}
+
+static void fpga_region_core_unpin_user_pages(struct page **pages, int nr_pages)
+{
+	unpin_user_pages(pages, nr_pages);
+}
+#else
+static int fpga_region_core_pin_user_pages(unsigned long start, int nr_pages,
+					   struct page **pages)
+{
+	return get_user_pages_fast(start, nr_pages, FOLL_LONGTERM, pages);
+}
+
+static void fpga_region_core_unpin_user_pages(struct page **pages, int nr_pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++)
+		put_page(pages[i]);
+}
+#endif
+
+/*
+ * A staged dma-buf is read by the CPU, or handed to the FPGA manager like a
+ * firmware buffer, through a kernel mapping.  The exporter owns its sg
+ * table, which is already mapped for the device it was attached to, so it
+ * can't be passed on to the FPGA manager.
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+static void *fpga_region_core_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+	struct iosys_map map;
+	int ret;
+
+	ret = dma_buf_vmap_unlocked(dmabuf, &map);
+	if (ret)
+		return ERR_PTR(ret);
+	if (map.is_iomem) {
+		dma_buf_vunmap_unlocked(dmabuf, &map);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	return map.vaddr;
+}
+
+static void fpga_region_core_dmabuf_vunmap(struct dma_buf *dmabuf, void *vaddr)
+{
+	struct iosys_map map = IOSYS_MAP_INIT_VADDR(vaddr);
+
+	dma_buf_vunmap_unlocked(dmabuf, &map);
+}
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
+static void *fpga_region_core_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+	struct iosys_map map;
+	int ret;
+
+	ret = dma_buf_vmap(dmabuf, &map);
+	if (ret)
+		return ERR_PTR(ret);
+	if (map.is_iomem) {
+		dma_buf_vunmap(dmabuf, &map);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	return map.vaddr;
+}
+
+static void fpga_region_core_dmabuf_vunmap(struct dma_buf *dmabuf, void *vaddr)
+{
+	struct iosys_map map = IOSYS_MAP_INIT_VADDR(vaddr);
+
+	dma_buf_vunmap(dmabuf, &map);
+}
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+static void *fpga_region_core_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+	struct dma_buf_map map;
+	int ret;
+
+	ret = dma_buf_vmap(dmabuf, &map);
+	if (ret)
+		return ERR_PTR(ret);
+	if (map.is_iomem) {
+		dma_buf_vunmap(dmabuf, &map);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	return map.vaddr;
+}
+
+static void fpga_region_core_dmabuf_vunmap(struct dma_buf *dmabuf, void *vaddr)
+{
+	struct dma_buf_map map = DMA_BUF_MAP_INIT_VADDR(vaddr);
+
+	dma_buf_vunmap(dmabuf, &map);
+}
+#else
+static void *fpga_region_core_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+	void *vaddr = dma_buf_vmap(dmabuf);
+
+	return (vaddr) ? vaddr : ERR_PTR(-ENOMEM);
+}
+
+static void fpga_region_core_dmabuf_vunmap(struct dma_buf *dmabuf, void *vaddr)
+{
+	dma_buf_vunmap(dmabuf, vaddr);
+}
+#endif
+
+/*
+ * Drop the staged image of a region.  Caller must hold region->mutex.
+ */
+static void __fpga_region_core_unstage(struct fpga_region_core *region)
+{
+	struct fpga_region_core_staged_image *staged = &region->staged;
+
+	if (staged->dmabuf) {
+		fpga_region_core_dmabuf_vunmap(staged->dmabuf, staged->vaddr);
+		dma_buf_put(staged->dmabuf);
+	}
+
+	if (staged->pages) {
+		sg_free_table(&staged->table);
+		fpga_region_core_unpin_user_pages(staged->pages, staged->nr_pages);
+		kvfree(staged->pages);
+	}
+
+	memset(staged, 0, sizeof(*staged));
+}
+
+/**
+ * fpga_region_core_stage_dmabuf - stage a dma-buf as the image of a region
+ * @region: FPGA region
+ * @fd: file descriptor of the dma-buf
+ *
+ * The dma-buf is mapped into the kernel, and is used by the next
+ * programming whose image info has the FPGA_MGR_CONFIG_DMA_BUF flag.  The
+ * whole dma-buf is the image.  It stays staged, replacing any image staged
+ * before, until fpga_region_core_unstage() or the region is unregistered.
+ *
+ * Return 0 for success, -EOPNOTSUPP if the dma-buf can only be mapped as
+ * I/O memory, or negative error code.
+ */
+int fpga_region_core_stage_dmabuf(struct fpga_region_core *region, int fd)
+{
+	struct fpga_region_core_staged_image *staged = &region->staged;
+	struct dma_buf *dmabuf;
+	void *vaddr;
+	int ret;
+
+	dmabuf = dma_buf_get(fd);
+	if (IS_ERR(dmabuf))
+		return PTR_ERR(dmabuf);
+
+	if (!dmabuf->size) {
+		ret = -EINVAL;
+		goto err_put;
+	}
+
+	vaddr = fpga_region_core_dmabuf_vmap(dmabuf);
+	if (IS_ERR(vaddr)) {
+		ret = PTR_ERR(vaddr);
+		goto err_put;
+	}
+
+	mutex_lock(&region->mutex);
+	__fpga_region_core_unstage(region);
+	staged->dmabuf = dmabuf;
+	staged->vaddr  = vaddr;
+	staged->size   = dmabuf->size;
+	fpga_region_core_unlock(region);
+
+	return 0;
+
+err_put:
+	dma_buf_put(dmabuf);
+	return ret;
 }
-EXPORT_SYMBOL_GPL(fpga_region_core_class_find);
+EXPORT_SYMBOL_GPL(fpga_region_core_stage_dmabuf);
 
 /**
- * fpga_region_core_get - get an exclusive reference to a fpga region core
- * @region: FPGA Region struct
+ * fpga_region_core_stage_user - stage a user buffer as the image of a region
+ * @region: FPGA region
+ * @addr: user address of the image
+ * @size: size of the image in bytes
  *
- * Caller should call fpga_region_core_put() when done with region.
+ * The pages of the buffer are pinned, and are used in place by the next
+ * programming whose image info has the FPGA_MGR_CONFIG_DMA_BUF flag.  The
+ * caller must not modify the buffer while it is staged.  It stays staged,
+ * replacing any image staged before, until fpga_region_core_unstage() or
+ * the region is unregistered.
  *
- * Return fpga_region struct if successful.
- * Return -EBUSY if someone already has a reference to the region.
- * Return -ENODEV if @np is not a FPGA Region.
+ * Return 0 for success or negative error code.
  */
-static struct fpga_region_core *fpga_region_core_get(struct fpga_region_core *region)
+int fpga_region_core_stage_user(struct fpga_region_core *region,
+				unsigned long addr, size_t size)
 {
-	struct device *dev = &region->dev;
+	struct fpga_region_core_staged_image *staged = &region->staged;
+	struct sg_table table;
+	struct page **pages;
+	unsigned long nr_pages;
+	int pinned;
+	int ret;
 
-	if (!mutex_trylock(&region->mutex)) {
-		dev_dbg(dev, "%s: FPGA Region already in use\n", __func__);
-		return ERR_PTR(-EBUSY);
-	}
+	if (!size || addr + size < addr)
+		return -EINVAL;
 
-	get_device(dev);
-	if (!try_module_get(dev->parent->driver->owner)) {
-		put_device(dev);
-		mutex_unlock(&region->mutex);
-		return ERR_PTR(-ENODEV);
+	nr_pages = DIV_ROUND_UP(addr + size, PAGE_SIZE) - addr / PAGE_SIZE;
+	if (nr_pages > INT_MAX)
+		return -EINVAL;
+
+	pages = kvmalloc_array(nr_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	pinned = fpga_region_core_pin_user_pages(addr & PAGE_MASK, nr_pages, pages);
+	if (pinned < 0) {
+		ret = pinned;
+		goto err_free;
+	}
+	if (pinned != nr_pages) {
+		ret = -EFAULT;
+		goto err_unpin_pages;
 	}
 
-	dev_dbg(dev, "get\n");
+	ret = sg_alloc_table_from_pages(&table, pages, nr_pages,
+					offset_in_page(addr), size, GFP_KERNEL);
+	if (ret)
+		goto err_unpin_pages;
 
-	return region;
+	mutex_lock(&region->mutex);
+	__fpga_region_core_unstage(region);
+	staged->pages    = pages;
+	staged->nr_pages = nr_pages;
+	staged->table    = table;
+	staged->sgt      = &staged->table;
+	fpga_region_core_unlock(region);
+
+	return 0;
+
+err_unpin_pages:
+	fpga_region_core_unpin_user_pages(pages, pinned);
+err_free:
+	kvfree(pages);
+	return ret;
 }
+EXPORT_SYMBOL_GPL(fpga_region_core_stage_user);
 
 /**
- * fpga_region_core_put - release a reference to a region
+ * fpga_region_core_unstage - drop the staged image of a region
+ * @region: FPGA region
  *
+ * Waits for programming that is using the staged image to finish.
+ */
+void fpga_region_core_unstage(struct fpga_region_core *region)
+{
+	mutex_lock(&region->mutex);
+	__fpga_region_core_unstage(region);
+	fpga_region_core_unlock(region);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_unstage);
+
+/**
+ * fpga_region_core_interfaces_enable - enable the interfaces of a region
  * @region: FPGA region
+ *
+ * Return 0 for success or negative error code.
  */
-static void fpga_region_core_put(struct fpga_region_core *region)
+static int fpga_region_core_interfaces_enable(struct fpga_region_core *region)
 {
-	struct device *dev = &region->dev;
+	if (region->parallel_interfaces)
+		return fpga_region_interfaces_enable_parallel(&region->interface_list);
 
-	dev_dbg(dev, "put\n");
+	return fpga_region_interfaces_enable(&region->interface_list);
+}
 
-	module_put(dev->parent->driver->owner);
-	put_device(dev);
-	mutex_unlock(&region->mutex);
+/**
+ * fpga_region_core_interfaces_disable - disable the interfaces of a region
+ * @region: FPGA region
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_core_interfaces_disable(struct fpga_region_core *region)
+{
+	if (region->parallel_interfaces)
+		return fpga_region_interfaces_disable_parallel(&region->interface_list);
+
+	return fpga_region_interfaces_disable(&region->interface_list);
 }
 
 /**
- * fpga_region_core_program_fpga - program FPGA
+ * fpga_region_core_image_is_loaded - check if the prepared image is loaded
+ * @region: FPGA region, with its manager locked
  *
- * @region: FPGA region
+ * Return true if the region last loaded the image with the same digest and
+ * nothing has overwritten it since.
+ */
+static bool fpga_region_core_image_is_loaded(struct fpga_region_core *region)
+{
+	const struct fpga_region_core_digest *image  = &region->image.digest;
+	const struct fpga_region_core_digest *loaded = &region->loaded;
+
+	return image->valid && loaded->valid &&
+	       image->size == loaded->size &&
+	       !memcmp(image->value, loaded->value, sizeof(image->value)) &&
+	       region->mgr->state == FPGA_MGR_STATE_OPERATING;
+}
+
+/*
+ * Record the digest of the image loaded into a region, or forget it if
+ * @digest is NULL.  The first 16 bytes of the digest serve as the
+ * compat_id of a region that has none of its own.
+ */
+static void fpga_region_core_set_loaded(struct fpga_region_core *region,
+					const struct fpga_region_core_digest *digest)
+{
+	if (!digest || !digest->valid) {
+		region->loaded.valid = false;
+		if (region->compat_id == &region->loaded_compat_id)
+			region->compat_id = NULL;
+		return;
+	}
+
+	region->loaded = *digest;
+	region->loaded_compat_id.id_h = get_unaligned_be64(&digest->value[0]);
+	region->loaded_compat_id.id_l = get_unaligned_be64(&digest->value[8]);
+	if (!region->compat_id)
+		region->compat_id = &region->loaded_compat_id;
+}
+
+static int fpga_region_core_forget_loaded(struct device *dev, void *data)
+{
+	struct fpga_region_core *region = to_fpga_region_core(dev);
+	struct fpga_region_core *loader = data;
+
+	if (region != loader && region->mgr == loader->mgr)
+		fpga_region_core_set_loaded(region, NULL);
+
+	return 0;
+}
+
+/**
+ * fpga_region_core_update_loaded - record the result of an image load
+ * @region: FPGA region, with its manager locked
+ * @ret: result of the load
  *
- * Program an FPGA using fpga image info (region->info).
- * If the region has a get_bridges function, the exclusive reference for the
- * bridges will be held if programming succeeds.  This is intended to prevent
- * reprogramming the region until the caller considers it safe to do so.
- * The caller will need to call fpga_bridges_put() before attempting to
- * reprogram the region.
+ * A full reconfiguration, or a failed load of any kind, leaves the manager
+ * with none of the images the other regions on it had loaded.
+ */
+static void fpga_region_core_update_loaded(struct fpga_region_core *region, int ret)
+{
+	if (ret || !(region->info->flags & FPGA_MGR_PARTIAL_RECONFIG))
+		class_for_each_device(fpga_region_core_class, NULL, region,
+				      fpga_region_core_forget_loaded);
+
+	fpga_region_core_set_loaded(region, (ret) ? NULL : &region->image.digest);
+}
+
+/**
+ * __fpga_region_core_program_fpga - program FPGA
+ *
+ * @region: FPGA region
+ * @request: request to wait for the region and manager with, or NULL
  *
  * Return 0 for success or negative error code.
  */
-int fpga_region_core_program_fpga(struct fpga_region_core *region)
+static int __fpga_region_core_program_fpga(struct fpga_region_core *region,
+					   struct fpga_region_core_request *request)
 {
 	struct device *dev = &region->dev;
-	struct fpga_image_info *info = region->info;
+	bool force = false;
 	int ret;
 
-	region = fpga_region_core_get(region);
+	region = fpga_region_core_get(region, request);
 	if (IS_ERR(region)) {
 		dev_err(dev, "failed to get FPGA region\n");
 		return PTR_ERR(region);
 	}
 
-	ret = fpga_mgr_lock(region->mgr);
+	if (region->info) {
+		force = !!(region->info->flags & FPGA_REGION_CORE_CONFIG_FORCE);
+		region->info->flags &= ~FPGA_REGION_CORE_CONFIG_FORCE;
+	}
+
+	ret = fpga_region_core_image_prepare(region);
 	if (ret) {
-		dev_err(dev, "FPGA manager is busy\n");
+		dev_err(dev, "failed to prepare FPGA image\n");
 		goto err_put_region;
 	}
 
+	ret = fpga_region_core_mgr_lock(region, request);
+	if (ret) {
+		dev_err(dev, "FPGA manager is busy\n");
+		goto err_release_image;
+	}
+
+	fpga_region_core_set_status(region, FPGA_REGION_CORE_STATUS_PROGRAMMING, 0);
+
 	/*
 	 * In some cases, we already have a list of bridges in the
 	 * fpga region struct.  Or we don't have any bridges.
@@ -123,25 +2026,33 @@ int fpga_region_core_program_fpga(struct fpga_region_core *region)
 		}
 	}
 
-	ret = fpga_region_interfaces_disable(&region->interface_list);
-	if (ret) {
-		dev_err(dev, "failed to disable region interfaces\n");
-		goto err_put_br;
-	}
+	if (!force && fpga_region_core_image_is_loaded(region)) {
+		/* Only the interface settings change. */
+		dev_dbg(dev, "FPGA image is already loaded\n");
+	} else {
+		ret = fpga_region_core_interfaces_disable(region);
+		if (ret) {
+			dev_err(dev, "failed to disable region interfaces\n");
+			goto err_put_br;
+		}
 
-	ret = fpga_mgr_load(region->mgr, info);
-	if (ret) {
-		dev_err(dev, "failed to load FPGA image\n");
-		goto err_put_br;
+		ret = fpga_region_core_image_load(region);
+		fpga_region_core_update_loaded(region, ret);
+		if (ret) {
+			dev_err(dev, "failed to load FPGA image\n");
+			goto err_put_br;
+		}
 	}
 
-	ret = fpga_region_interfaces_enable(&region->interface_list);
+	ret = fpga_region_core_interfaces_enable(region);
 	if (ret) {
 		dev_err(dev, "failed to enable region interfaces\n");
 		goto err_put_br;
 	}
 
-	fpga_mgr_unlock(region->mgr);
+	fpga_region_core_mgr_unlock(region);
+	fpga_region_core_image_release(region);
+	fpga_region_core_set_status(region, FPGA_REGION_CORE_STATUS_OPERATING, 0);
 	fpga_region_core_put(region);
 
 	return 0;
@@ -150,14 +2061,228 @@ err_put_br:
 	if (region->get_interfaces)
 		fpga_region_interfaces_put(&region->interface_list);
 err_unlock_mgr:
-	fpga_mgr_unlock(region->mgr);
+	fpga_region_core_mgr_unlock(region);
+err_release_image:
+	fpga_region_core_image_release(region);
 err_put_region:
+	fpga_region_core_set_status(region, FPGA_REGION_CORE_STATUS_ERROR, ret);
 	fpga_region_core_put(region);
 
 	return ret;
 }
+
+/**
+ * fpga_region_core_program_fpga - program FPGA
+ *
+ * @region: FPGA region
+ *
+ * Program an FPGA using fpga image info (region->info).
+ * If the region has a get_bridges function, the exclusive reference for the
+ * bridges will be held if programming succeeds.  This is intended to prevent
+ * reprogramming the region until the caller considers it safe to do so.
+ * The caller will need to call fpga_bridges_put() before attempting to
+ * reprogram the region.
+ *
+ * Programming is done in two phases.  The image is fetched, size-checked and
+ * mapped first, while the interfaces are still enabled.  The interfaces are
+ * then disabled only for the configuration write to the manager.
+ *
+ * If the region last loaded an image with the same SHA-256 digest and the
+ * manager has not been reconfigured since, the image is not loaded again;
+ * only the interfaces are set up and enabled.  Set
+ * FPGA_REGION_CORE_CONFIG_FORCE in the flags of region->info to load the
+ * image regardless.
+ *
+ * Return 0 for success or negative error code.  -EBUSY is returned at once
+ * if the region or its FPGA manager is in use.
+ */
+int fpga_region_core_program_fpga(struct fpga_region_core *region)
+{
+	return __fpga_region_core_program_fpga(region, NULL);
+}
 EXPORT_SYMBOL_GPL(fpga_region_core_program_fpga);
 
+/**
+ * fpga_region_core_program_fpga_queued - program FPGA, waiting for the region
+ *
+ * @region: FPGA region
+ * @request: request initialized with fpga_region_core_request_init()
+ *
+ * Same as fpga_region_core_program_fpga(), but instead of failing with
+ * -EBUSY the caller sleeps until the region and its FPGA manager are free.
+ * Waiting requests get the region in order of priority, and in FIFO order
+ * within a priority.  The request can be cancelled from another context
+ * with fpga_region_core_cancel_request().
+ *
+ * Return 0 for success or negative error code: -ETIMEDOUT if the timeout of
+ * the request expired, -ECANCELED if it was cancelled, or -ERESTARTSYS if
+ * the caller was interrupted by a signal while waiting.
+ */
+int fpga_region_core_program_fpga_queued(struct fpga_region_core *region,
+					 struct fpga_region_core_request *request)
+{
+	return __fpga_region_core_program_fpga(region, request);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_program_fpga_queued);
+
+static void fpga_region_core_program_work(struct work_struct *work)
+{
+	struct fpga_region_core *region =
+		container_of(work, struct fpga_region_core, program_work);
+	bool pending;
+	int ret;
+
+	ret = fpga_region_core_program_fpga_queued(region, &region->async_request);
+
+	/* The region could not even be taken; report it as a failure. */
+	if (ret) {
+		spin_lock(&region->request_lock);
+		pending = (region->status == FPGA_REGION_CORE_STATUS_PENDING);
+		if (pending) {
+			region->status       = FPGA_REGION_CORE_STATUS_ERROR;
+			region->status_error = ret;
+		}
+		spin_unlock(&region->request_lock);
+		if (pending)
+			sysfs_notify(&region->dev.kobj, NULL, "status");
+	}
+
+	if (region->program_done)
+		region->program_done(region, ret);
+}
+
+/**
+ * fpga_region_core_program_fpga_async - queue programming of the FPGA
+ *
+ * @region: FPGA region
+ * @priority: priority of the request for the region
+ * @timeout_ms: give up waiting for the region after this many milliseconds,
+ *              0 to wait until cancelled
+ *
+ * Queue fpga_region_core_program_fpga_queued() on the fpga_region_core
+ * workqueue and return immediately.  The region status becomes "pending"
+ * and changes to "operating" or "error" when programming finishes; the
+ * status attribute can be polled for that, and region->program_done is
+ * called with the result if it is set.  region->info must stay valid
+ * until then, so call fpga_region_core_program_wait() or
+ * fpga_region_core_program_cancel() before freeing it.
+ *
+ * Return 0 if programming was queued or -EBUSY if it is already pending.
+ */
+int fpga_region_core_program_fpga_async(struct fpga_region_core *region,
+					int priority, unsigned int timeout_ms)
+{
+	if (work_pending(&region->program_work))
+		return -EBUSY;
+
+	fpga_region_core_request_init(&region->async_request, priority, timeout_ms);
+	fpga_region_core_set_status(region, FPGA_REGION_CORE_STATUS_PENDING, 0);
+	queue_work(fpga_region_core_wq, &region->program_work);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_program_fpga_async);
+
+/**
+ * fpga_region_core_program_wait - wait for asynchronous programming to finish
+ *
+ * @region: FPGA region
+ *
+ * Return 0 if the last programming succeeded or nothing has been programmed,
+ * negative error code of the last failed programming otherwise.
+ */
+int fpga_region_core_program_wait(struct fpga_region_core *region)
+{
+	int error;
+
+	flush_work(&region->program_work);
+
+	if (fpga_region_core_get_status(region, &error) == FPGA_REGION_CORE_STATUS_ERROR)
+		return error;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_program_wait);
+
+/**
+ * fpga_region_core_program_cancel - cancel asynchronous programming
+ *
+ * @region: FPGA region
+ *
+ * If asynchronous programming is still waiting for the region or its FPGA
+ * manager, it is cancelled.  Programming that has already started is waited
+ * for.
+ */
+void fpga_region_core_program_cancel(struct fpga_region_core *region)
+{
+	fpga_region_core_cancel_request(region, &region->async_request);
+	flush_work(&region->program_work);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_program_cancel);
+
+/**
+ * fpga_region_core_update_interfaces - change the interface setup of a programmed region
+ *
+ * @region: FPGA region
+ * @np: node with a child node for each interface to change, named as the
+ *      interface
+ *
+ * Applies the settings in @np to the interfaces held by the region since it
+ * was programmed, while they stay enabled, see
+ * fpga_region_interfaces_of_update().  The FPGA image is not touched.
+ *
+ * Return 0 for success or negative error code.  -EBUSY is returned if the
+ * region is in use or is not operating.
+ */
+int fpga_region_core_update_interfaces(struct fpga_region_core *region,
+				       struct device_node *np)
+{
+	struct device *dev = &region->dev;
+	int ret;
+
+	region = fpga_region_core_get(region, NULL);
+	if (IS_ERR(region)) {
+		dev_err(dev, "failed to get FPGA region\n");
+		return PTR_ERR(region);
+	}
+
+	if (fpga_region_core_get_status(region, NULL) != FPGA_REGION_CORE_STATUS_OPERATING) {
+		dev_err(dev, "FPGA region is not operating\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = fpga_region_interfaces_of_update(&region->interface_list, np);
+	if (ret)
+		dev_err(dev, "failed to update region interfaces\n");
+out:
+	fpga_region_core_put(region);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_update_interfaces);
+
+/**
+ * fpga_region_core_release_interfaces - release the interfaces of a programmed region
+ *
+ * @region: FPGA region
+ *
+ * Cancels asynchronous programming that is still waiting, or waits for it
+ * to finish, then disables the interfaces held by the region since it was
+ * programmed and puts them.  The interface list is changed under the region
+ * mutex, so this can't race fpga_region_core_update_interfaces().
+ */
+void fpga_region_core_release_interfaces(struct fpga_region_core *region)
+{
+	fpga_region_core_program_cancel(region);
+
+	mutex_lock(&region->mutex);
+	fpga_region_core_interfaces_disable(region);
+	fpga_region_interfaces_put(&region->interface_list);
+	fpga_region_core_unlock(region);
+}
+EXPORT_SYMBOL_GPL(fpga_region_core_release_interfaces);
+
 static ssize_t compat_id_show(struct device *dev,
 			      struct device_attribute *attr, char *buf)
 {
@@ -171,14 +2296,114 @@ static ssize_t compat_id_show(struct device *dev,
 		       (unsigned long long)region->compat_id->id_l);
 }
 
+static ssize_t status_show(struct device *dev,
+			   struct device_attribute *attr, char *buf)
+{
+	struct fpga_region_core *region = to_fpga_region_core(dev);
+	bool programmed = READ_ONCE(region->info) != NULL;
+	int error;
+
+	switch (fpga_region_core_get_status(region, &error)) {
+	case FPGA_REGION_CORE_STATUS_PENDING:
+		return sprintf(buf, "pending\n");
+	case FPGA_REGION_CORE_STATUS_PROGRAMMING:
+		return sprintf(buf, "programming\n");
+	case FPGA_REGION_CORE_STATUS_OPERATING:
+		if (programmed)
+			return sprintf(buf, "operating\n");
+		break;
+	case FPGA_REGION_CORE_STATUS_ERROR:
+		if (programmed)
+			return sprintf(buf, "error(%d)\n", error);
+		break;
+	default:
+		break;
+	}
+
+	return sprintf(buf, "idle\n");
+}
+
 static DEVICE_ATTR_RO(compat_id);
+static DEVICE_ATTR_RO(status);
 
 static struct attribute *fpga_region_core_attrs[] = {
 	&dev_attr_compat_id.attr,
+	&dev_attr_status.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(fpga_region_core);
 
+#define FPGA_REGION_CORE_CACHE_ATTR(_name, _fmt)			\
+static ssize_t cache_##_name##_show(struct class *class,		\
+				    struct class_attribute *attr,	\
+				    char *buf)				\
+{									\
+	struct fpga_region_core_cache *cache = &fpga_region_core_cache;\
+	ssize_t len;							\
+									\
+	mutex_lock(&cache->lock);					\
+	len = sprintf(buf, _fmt "\n", cache->_name);			\
+	mutex_unlock(&cache->lock);					\
+	return len;							\
+}									\
+static CLASS_ATTR_RO(cache_##_name)
+
+FPGA_REGION_CORE_CACHE_ATTR(hits, "%lu");
+FPGA_REGION_CORE_CACHE_ATTR(misses, "%lu");
+FPGA_REGION_CORE_CACHE_ATTR(evictions, "%lu");
+FPGA_REGION_CORE_CACHE_ATTR(entries, "%u");
+FPGA_REGION_CORE_CACHE_ATTR(bytes, "%zu");
+
+/*
+ * Writing a firmware name drops the cached image of that name; writing an
+ * empty line drops every cached image.
+ */
+static ssize_t cache_flush_store(struct class *class,
+				 struct class_attribute *attr,
+				 const char *buf, size_t count)
+{
+	char *name, *trimmed;
+
+	name = kstrndup(buf, count, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	trimmed = strim(name);
+	fpga_region_core_cache_flush((*trimmed) ? trimmed : NULL);
+	kfree(name);
+
+	return count;
+}
+static CLASS_ATTR_WO(cache_flush);
+
+#define FPGA_REGION_CORE_DECOMP_ATTR(_name)				\
+static ssize_t decompress_##_name##_show(struct class *class,		\
+					 struct class_attribute *attr,	\
+					 char *buf)			\
+{									\
+	return sprintf(buf, "%lld\n",					\
+		       atomic64_read(&fpga_region_core_decomp_stats._name)); \
+}									\
+static CLASS_ATTR_RO(decompress_##_name)
+
+FPGA_REGION_CORE_DECOMP_ATTR(in_bytes);
+FPGA_REGION_CORE_DECOMP_ATTR(out_bytes);
+FPGA_REGION_CORE_DECOMP_ATTR(usecs);
+
+static struct attribute *fpga_region_core_class_attrs[] = {
+	&class_attr_cache_hits.attr,
+	&class_attr_cache_misses.attr,
+	&class_attr_cache_evictions.attr,
+	&class_attr_cache_entries.attr,
+	&class_attr_cache_bytes.attr,
+	&class_attr_cache_flush.attr,
+	&class_attr_decompress_in_bytes.attr,
+	&class_attr_decompress_out_bytes.attr,
+	&class_attr_decompress_usecs.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(fpga_region_core_class);
+
 /**
  * fpga_region_core_create - alloc and init a struct fpga_region_core
  * @dev: device parent
@@ -211,6 +2436,13 @@ struct fpga_region_core
 	region->get_interfaces = get_interfaces;
 	mutex_init(&region->mutex);
 	INIT_LIST_HEAD(&region->interface_list);
+	INIT_WORK(&region->program_work, fpga_region_core_program_work);
+	INIT_LIST_HEAD(&region->mgr_claim_node);
+	spin_lock_init(&region->request_lock);
+	INIT_LIST_HEAD(&region->request_queue);
+	init_waitqueue_head(&region->request_wq);
+	fpga_region_core_request_init(&region->async_request, 0, 0);
+	INIT_HLIST_NODE(&region->index_node);
 
 	device_initialize(&region->dev);
 	region->dev.class = fpga_region_core_class;
@@ -298,7 +2530,21 @@ EXPORT_SYMBOL_GPL(devm_fpga_region_core_create);
  */
 int fpga_region_core_register(struct fpga_region_core *region)
 {
-	return device_add(&region->dev);
+	int ret;
+
+	ret = device_add(&region->dev);
+	if (ret)
+		return ret;
+
+	if (region->dev.of_node) {
+		spin_lock(&fpga_region_core_index_lock);
+		hash_add(fpga_region_core_index, &region->index_node,
+			 (unsigned long)region->dev.of_node);
+		WRITE_ONCE(fpga_region_core_index_count, fpga_region_core_index_count + 1);
+		spin_unlock(&fpga_region_core_index_lock);
+	}
+
+	return 0;
 }
 EXPORT_SYMBOL_GPL(fpga_region_core_register);
 
@@ -310,6 +2556,15 @@ EXPORT_SYMBOL_GPL(fpga_region_core_register);
  */
 void fpga_region_core_unregister(struct fpga_region_core *region)
 {
+	spin_lock(&fpga_region_core_index_lock);
+	if (!hlist_unhashed(&region->index_node)) {
+		hash_del(&region->index_node);
+		WRITE_ONCE(fpga_region_core_index_count, fpga_region_core_index_count - 1);
+	}
+	spin_unlock(&fpga_region_core_index_lock);
+
+	fpga_region_core_program_cancel(region);
+	fpga_region_core_unstage(region);
 	device_unregister(&region->dev);
 }
 EXPORT_SYMBOL_GPL(fpga_region_core_unregister);
@@ -320,22 +2575,46 @@ static void fpga_region_core_dev_release(struct device *dev)
 
 /**
  * fpga_region_core_init - init function for fpga_region_core class
- * Creates the fpga_region_core class and registers a reconfig notifier.
+ * Creates the fpga_region_core class and registers the image cache shrinker.
  */
 static int __init fpga_region_core_init(void)
 {
+	int ret;
+
 	fpga_region_core_class = class_create(THIS_MODULE, "fpga_region_core");
 	if (IS_ERR(fpga_region_core_class))
 		return PTR_ERR(fpga_region_core_class);
 
-	fpga_region_core_class->dev_groups  = fpga_region_core_groups;
-	fpga_region_core_class->dev_release = fpga_region_core_dev_release;
+	fpga_region_core_class->class_groups = fpga_region_core_class_groups;
+	fpga_region_core_class->dev_groups   = fpga_region_core_groups;
+	fpga_region_core_class->dev_release  = fpga_region_core_dev_release;
+
+	fpga_region_core_wq = alloc_workqueue("fpga_region_core", WQ_UNBOUND, 0);
+	if (!fpga_region_core_wq) {
+		ret = -ENOMEM;
+		goto err_class;
+	}
+
+	ret = register_shrinker(&fpga_region_core_cache_shrinker);
+	if (ret)
+		goto err_wq;
 
 	return 0;
+
+err_wq:
+	destroy_workqueue(fpga_region_core_wq);
+err_class:
+	class_destroy(fpga_region_core_class);
+	return ret;
 }
 
 static void __exit fpga_region_core_exit(void)
 {
+	unregister_shrinker(&fpga_region_core_cache_shrinker);
+	destroy_workqueue(fpga_region_core_wq);
+	fpga_region_core_cache_flush(NULL);
+	if (fpga_region_core_digest_tfm)
+		crypto_free_shash(fpga_region_core_digest_tfm);
 	class_destroy(fpga_region_core_class);
 	ida_destroy(&fpga_region_core_ida);
 }
@@ -346,3 +2625,6 @@ module_exit(fpga_region_core_exit);
 MODULE_DESCRIPTION("FPGA Region Core");
 MODULE_AUTHOR("Alan Tull <atull@kernel.org>");
 MODULE_LICENSE("GPL v2");
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0))
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
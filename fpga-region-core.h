@@ -4,19 +4,151 @@
 #define _FPGA_REGION_CORE_H
 
 #include <linux/device.h>
+#include <linux/firmware.h>
 #include <linux/fpga/fpga-mgr.h>
+#include <linux/scatterlist.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include "fpga-region-interface.h"
 
+/**
+ * enum fpga_region_core_status - programming status of a region
+ * @FPGA_REGION_CORE_STATUS_IDLE: no image has been programmed
+ * @FPGA_REGION_CORE_STATUS_PENDING: programming is queued on the workqueue,
+ *                                   or waits for the region or its manager
+ * @FPGA_REGION_CORE_STATUS_PROGRAMMING: the FPGA manager is held and
+ *                                       programming is in progress
+ * @FPGA_REGION_CORE_STATUS_OPERATING: the last programming succeeded
+ * @FPGA_REGION_CORE_STATUS_ERROR: the last programming failed
+ */
+enum fpga_region_core_status {
+	FPGA_REGION_CORE_STATUS_IDLE,
+	FPGA_REGION_CORE_STATUS_PENDING,
+	FPGA_REGION_CORE_STATUS_PROGRAMMING,
+	FPGA_REGION_CORE_STATUS_OPERATING,
+	FPGA_REGION_CORE_STATUS_ERROR,
+};
+
+struct fpga_region_core_cache_entry;
+struct dma_buf;
+
+#define FPGA_REGION_CORE_DIGEST_SIZE	32
+
+/*
+ * Flag of struct fpga_image_info: load the image even if the region already
+ * holds it.  The flag is cleared when programming starts, so it applies to
+ * that programming only and never reaches the FPGA manager.
+ */
+#define FPGA_REGION_CORE_CONFIG_FORCE	BIT(31)
+
+/**
+ * struct fpga_region_core_digest - SHA-256 digest of a FPGA image
+ * @value: digest
+ * @size: size of the image in bytes
+ * @valid: @value and @size are set
+ *
+ * The digest covers the image as it is stored, before any decompression.
+ */
+struct fpga_region_core_digest {
+	u8 value[FPGA_REGION_CORE_DIGEST_SIZE];
+	u64 size;
+	bool valid;
+};
+
+/**
+ * struct fpga_region_core_request - request waiting for a region
+ * @priority: requests with a higher priority are served first, requests of
+ *            the same priority in FIFO order
+ * @timeout_ms: give up after this many milliseconds, 0 to wait forever
+ * @node: entry in the request queue of the region
+ * @deadline: jiffies at which the request times out
+ * @cancelled: the request has been cancelled
+ * @acquired: the request got the resource it was waiting for
+ *
+ * Initialize with fpga_region_core_request_init().
+ */
+struct fpga_region_core_request {
+	int priority;
+	unsigned int timeout_ms;
+	struct list_head node;
+	unsigned long deadline;
+	bool cancelled;
+	bool acquired;
+};
+
+/**
+ * struct fpga_region_core_image - FPGA image fetched by the prepare phase
+ * @entry: image cache entry holding the firmware
+ * @sgt: scatter-gather table built from the firmware buffer
+ * @sgt_valid: @sgt has been allocated and must be freed
+ * @staged: the staged image of the region is being loaded
+ * @decompressed: image decompressed from the firmware
+ * @decompressed_size: size of @decompressed
+ * @digest: digest of the image
+ */
+struct fpga_region_core_image {
+	struct fpga_region_core_cache_entry *entry;
+	void *decompressed;
+	size_t decompressed_size;
+	struct fpga_region_core_digest digest;
+	struct sg_table sgt;
+	bool sgt_valid;
+	bool staged;
+};
+
+/**
+ * struct fpga_region_core_staged_image - FPGA image handed over by the caller
+ *
+ * Nothing is staged if both @sgt and @vaddr are NULL.
+ *
+ * @sgt: scatter-gather table of the staged user pages
+ * @dmabuf: dma-buf the image was imported from
+ * @vaddr: kernel mapping of @dmabuf
+ * @size: size of @dmabuf
+ * @pages: pinned user pages of the image
+ * @nr_pages: number of entries in @pages
+ * @table: scatter-gather table built from @pages
+ */
+struct fpga_region_core_staged_image {
+	struct sg_table *sgt;
+	struct dma_buf *dmabuf;
+	void *vaddr;
+	size_t size;
+	struct page **pages;
+	int nr_pages;
+	struct sg_table table;
+};
+
 /**
  * struct fpga_region_core - FPGA Region Core structure
  * @dev: FPGA Region device
  * @mutex: enforces exclusive reference to region
- * @interface_list: list of FPGA bridges specified in region
+ * @interface_list: list of FPGA bridges specified in region, protected by
+ *                  @mutex; held from programming until
+ *                  fpga_region_core_release_interfaces()
  * @mgr: FPGA manager
  * @info: FPGA image info
  * @compat_id: FPGA region id for compatibility check.
+ * @image: FPGA image prepared before the interfaces are disabled
+ * @staged: FPGA image staged by the caller, protected by @mutex
+ * @loaded: digest of the image last loaded into the region
+ * @loaded_compat_id: compat_id derived from @loaded
+ * @program_work: work for asynchronous programming
+ * @status: programming status, protected by @request_lock
+ * @status_error: error code of the last failed programming, protected by
+ *                @request_lock
+ * @parallel_interfaces: enable/disable the interfaces concurrently
+ * @request_lock: protects @request_queue, the requests on it and @status
+ * @request_queue: requests waiting for the region, highest priority first
+ * @request_wq: wait queue of the requests on @request_queue
+ * @async_request: request used by asynchronous programming
+ * @mgr_claim_node: entry in the list of regions that hold their FPGA manager
+ * @index_node: entry in the device_node index of registered regions
  * @priv: private data
  * @get_interfaces: optional function to get fpga-region-interfaces to a list
+ * @program_done: optional function called with the result when asynchronous
+ *                programming finishes
  */
 struct fpga_region_core {
 	struct device dev;
@@ -25,8 +157,23 @@ struct fpga_region_core {
 	struct fpga_manager *mgr;
 	struct fpga_image_info *info;
 	struct fpga_compat_id *compat_id;
+	struct fpga_region_core_image image;
+	struct fpga_region_core_staged_image staged;
+	struct fpga_region_core_digest loaded;
+	struct fpga_compat_id loaded_compat_id;
+	struct work_struct program_work;
+	enum fpga_region_core_status status;
+	int status_error;
+	bool parallel_interfaces;
+	spinlock_t request_lock;
+	struct list_head request_queue;
+	wait_queue_head_t request_wq;
+	struct fpga_region_core_request async_request;
+	struct list_head mgr_claim_node;
+	struct hlist_node index_node;
 	void *priv;
 	int (*get_interfaces)(struct fpga_region_core *region);
+	void (*program_done)(struct fpga_region_core *region, int ret);
 };
 
 #define to_fpga_region_core(d) container_of(d, struct fpga_region_core, dev)
@@ -34,8 +181,28 @@ struct fpga_region_core {
 struct fpga_region_core *fpga_region_core_class_find(
 	struct device *start, const void *data,
 	int (*match)(struct device *, const void *));
+struct fpga_region_core *fpga_region_core_find_by_of_node(struct device_node *np);
 
 int fpga_region_core_program_fpga(struct fpga_region_core *region);
+int fpga_region_core_program_fpga_async(struct fpga_region_core *region,
+					int priority, unsigned int timeout_ms);
+int fpga_region_core_program_wait(struct fpga_region_core *region);
+void fpga_region_core_program_cancel(struct fpga_region_core *region);
+int fpga_region_core_update_interfaces(struct fpga_region_core *region,
+				       struct device_node *np);
+void fpga_region_core_release_interfaces(struct fpga_region_core *region);
+
+int fpga_region_core_stage_dmabuf(struct fpga_region_core *region, int fd);
+int fpga_region_core_stage_user(struct fpga_region_core *region,
+				unsigned long addr, size_t size);
+void fpga_region_core_unstage(struct fpga_region_core *region);
+
+void fpga_region_core_request_init(struct fpga_region_core_request *request,
+				   int priority, unsigned int timeout_ms);
+int fpga_region_core_program_fpga_queued(struct fpga_region_core *region,
+					 struct fpga_region_core_request *request);
+void fpga_region_core_cancel_request(struct fpga_region_core *region,
+				     struct fpga_region_core_request *request);
 
 struct fpga_region_core
 *fpga_region_core_create(struct device *dev, struct fpga_manager *mgr,
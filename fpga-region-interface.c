@@ -6,6 +6,8 @@
  *  Copyright (C) 2017 Intel Corporation
  *  Copyright (C) 2020 Ichiro Kawazome
  */
+#include <linux/async.h>
+#include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -18,8 +20,55 @@
 static DEFINE_IDA(fpga_region_interface_ida);
 static struct class *fpga_region_interface_class;
 
-/* Lock for adding/removing bridges to linked lists*/
-static spinlock_t fpga_region_interface_list_lock;
+/* Index of registered interfaces by device tree node */
+#define FPGA_REGION_INTERFACE_INDEX_BITS 6
+static DEFINE_HASHTABLE(fpga_region_interface_index, FPGA_REGION_INTERFACE_INDEX_BITS);
+static DEFINE_SPINLOCK(fpga_region_interface_index_lock);
+
+/* Incremented whenever an interface is registered or unregistered */
+static atomic_long_t fpga_region_interface_generation_count = ATOMIC_LONG_INIT(0);
+
+/**
+ * fpga_region_interface_generation - get the interface generation number
+ *
+ * The generation number changes whenever a fpga region interface is
+ * registered or unregistered.  Callers that cache the result of resolving
+ * interfaces can compare it to decide whether the cache is still valid.
+ *
+ * Return: current generation number.
+ */
+unsigned long fpga_region_interface_generation(void)
+{
+	return atomic_long_read(&fpga_region_interface_generation_count);
+}
+EXPORT_SYMBOL_GPL(fpga_region_interface_generation);
+
+/**
+ * fpga_region_interface_find_by_of_node - find a registered interface by device tree node
+ *
+ * @np: device tree node of the interface
+ *
+ * Caller will need to put_device() the returned device when done.
+ *
+ * Return: device of the interface or NULL.
+ */
+static struct device *fpga_region_interface_find_by_of_node(struct device_node *np)
+{
+	struct fpga_region_interface* interface;
+	struct device* dev = NULL;
+
+	spin_lock(&fpga_region_interface_index_lock);
+	hash_for_each_possible(fpga_region_interface_index, interface, index_node,
+			       (unsigned long)np) {
+		if (interface->dev.of_node == np) {
+			dev = get_device(&interface->dev);
+			break;
+		}
+	}
+	spin_unlock(&fpga_region_interface_index_lock);
+
+	return dev;
+}
 
 /**
  * fpga_region_interface_enable - Enable transactions on the fpga region interface
@@ -63,35 +112,84 @@ int fpga_region_interface_disable(struct fpga_region_interface* interface)
 }
 EXPORT_SYMBOL_GPL(fpga_region_interface_disable);
 
+/**
+ * fpga_region_interface_of_match - match a fpga region interface to a device tree node
+ *
+ * @interface: FPGA region interface
+ * @child: child node of the device tree node of the setup
+ *
+ * Return: true if @interface is of the fpga region interface class, has an
+ * of_setup operation and has the same name as @child, false otherwise.
+ */
+static bool fpga_region_interface_of_match(struct fpga_region_interface* interface,
+					   struct device_node* child)
+{
+	if (interface->dev.class != fpga_region_interface_class)
+		return false;
+	if (!interface->ops || !interface->ops->of_setup)
+		return false;
+	return of_node_name_eq(child, interface->name);
+}
+
 /**
  * fpga_region_interface_of_setup - Setup the fpga region interface by device tree node
  *
  * @interface: FPGA region interface
  * @np: node pointer of device tree
  *
+ * The setup is read from the child of @np that has the same name as the
+ * interface.
+ *
  * Return: 0 for success, error code otherwise.
  */
 int fpga_region_interface_of_setup(struct fpga_region_interface* interface, struct device_node* np)
 {
-  
+	struct device_node* child;
+	int retval;
+
 	dev_dbg(&interface->dev, "setup\n");
 
-	if (interface->dev.class != fpga_region_interface_class)
+	if (!np)
 		return 0;
 
-	if (interface->ops && interface->ops->of_setup) {
-		struct device_node* node = of_find_node_by_name(of_node_get(np), interface->name);
-		if (node) {
-			int retval = interface->ops->of_setup(interface, node);
-			of_node_put(node);
-			return retval;
-		}
+	for_each_child_of_node(np, child) {
+		if (!fpga_region_interface_of_match(interface, child))
+			continue;
+		retval = interface->ops->of_setup(interface, child);
+		of_node_put(child);
+		return retval;
 	}
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(fpga_region_interface_of_setup);
 
+/**
+ * fpga_region_interface_setup - Setup the fpga region interface by settings
+ *
+ * @interface: FPGA region interface
+ * @setting: settings of the interface for the region
+ *
+ * Interfaces that are not of the fpga region interface class, or that have
+ * no setup operation, are left untouched.
+ *
+ * Return: 0 for success, error code otherwise.
+ */
+int fpga_region_interface_setup(struct fpga_region_interface* interface,
+				const struct fpga_region_interface_setting* setting)
+{
+	dev_dbg(&interface->dev, "setup\n");
+
+	if (interface->dev.class != fpga_region_interface_class)
+		return 0;
+
+	if (interface->ops && interface->ops->setup)
+		return interface->ops->setup(interface, setting);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fpga_region_interface_setup);
+
 static struct fpga_region_interface *__fpga_region_interface_get(
 	struct device *dev,
 	struct fpga_image_info *info)
@@ -138,7 +236,7 @@ struct fpga_region_interface *of_fpga_region_interface_get(
 {
 	struct device *dev;
 
-	dev = class_find_device_by_of_node(fpga_region_interface_class, np);
+	dev = fpga_region_interface_find_by_of_node(np);
 	if (!dev)
 		return ERR_PTR(-ENODEV);
 
@@ -195,7 +293,10 @@ EXPORT_SYMBOL_GPL(fpga_region_interface_put);
  * fpga_region_interfaces_enable - enable fpga region interfaces in a list
  * @interface_list: list of fpga region interfaces
  *
- * Enable each interface in the list.  If list is empty, do nothing.
+ * Enable each interface in the list, in list order.  The get_to_list
+ * functions keep the list ordered by "interface-depends", so an interface
+ * is enabled after the interfaces it depends on.  If list is empty, do
+ * nothing.
  *
  * Return 0 for success or empty interface list; return error code otherwise.
  */
@@ -219,7 +320,9 @@ EXPORT_SYMBOL_GPL(fpga_region_interfaces_enable);
  *
  * @interface_list: list of fpga region interfaces
  *
- * Disable each interface in the list.  If list is empty, do nothing.
+ * Disable each interface in the list, in reverse list order, so an
+ * interface is disabled before the interfaces it depends on.  If list is
+ * empty, do nothing.
  *
  * Return 0 for success or empty interface list; return error code otherwise.
  */
@@ -238,31 +341,260 @@ int fpga_region_interfaces_disable(struct list_head* interface_list)
 }
 EXPORT_SYMBOL_GPL(fpga_region_interfaces_disable);
 
+/**
+ * struct fpga_region_interface_job - enable/disable job for one interface
+ * @interface: FPGA region interface
+ * @enable: enable or disable @interface
+ * @level: depth of @interface in the dependency graph of the list
+ * @ret: result of the job
+ */
+struct fpga_region_interface_job {
+	struct fpga_region_interface* interface;
+	bool enable;
+	int level;
+	int ret;
+};
+
+static void fpga_region_interface_job_func(void *data, async_cookie_t cookie)
+{
+	struct fpga_region_interface_job *job = data;
+
+	if (job->enable)
+		job->ret = fpga_region_interface_enable(job->interface);
+	else
+		job->ret = fpga_region_interface_disable(job->interface);
+}
+
+/**
+ * fpga_region_interface_level - depth of an interface in the dependency graph
+ *
+ * @interface: entry of an interface list
+ *
+ * fpga bridges don't take part in "interface-depends" and are at level 0.
+ */
+static int fpga_region_interface_level(struct fpga_region_interface* interface)
+{
+	if (interface->dev.class != fpga_region_interface_class)
+		return 0;
+
+	return interface->level;
+}
+
+/**
+ * fpga_region_interfaces_set_parallel - enable/disable fpga region interfaces concurrently
+ *
+ * @interface_list: list of fpga region interfaces
+ * @enable: enable or disable the interfaces
+ *
+ * The interfaces are grouped by the levels that the get_to_list functions
+ * resolved from their "interface-depends" properties.  Level by level,
+ * every interface of the level is handed to an async worker and all of
+ * them are joined before the next level starts.  Enable walks the levels
+ * upwards and disable walks them downwards, so an interface is enabled
+ * only after, and disabled only before, the interfaces it depends on.
+ * Within a level a failing interface does not stop the others, but no
+ * further level is started.  The error returned is the one the sequential
+ * walk would have hit first within the level: list order for enable and
+ * reverse list order for disable.
+ *
+ * Return 0 for success or empty interface list; return error code otherwise.
+ */
+static int fpga_region_interfaces_set_parallel(struct list_head* interface_list, bool enable)
+{
+	ASYNC_DOMAIN_EXCLUSIVE(domain);
+	struct fpga_region_interface_job* jobs;
+	struct fpga_region_interface*     interface;
+	int count = 0;
+	int levels = 0;
+	int l, i;
+	int ret = 0;
+
+	list_for_each_entry(interface, interface_list, node)
+		count++;
+
+	if (count <= 1)
+		goto sequential;
+
+	jobs = kcalloc(count, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs)
+		goto sequential;
+
+	i = 0;
+	list_for_each_entry(interface, interface_list, node) {
+		jobs[i].interface = interface;
+		jobs[i].enable    = enable;
+		jobs[i].level     = fpga_region_interface_level(interface);
+		levels = max(levels, jobs[i].level + 1);
+		i++;
+	}
+
+	for (l = 0; l < levels && !ret; l++) {
+		int level = (enable) ? l : levels - 1 - l;
+
+		for (i = 0; i < count; i++) {
+			if (jobs[i].level == level)
+				async_schedule_domain(fpga_region_interface_job_func,
+						      &jobs[i], &domain);
+		}
+		async_synchronize_full_domain(&domain);
+
+		for (i = 0; i < count; i++) {
+			struct fpga_region_interface_job* job = &jobs[enable ? i : count - 1 - i];
+			if (job->level == level && job->ret) {
+				ret = job->ret;
+				break;
+			}
+		}
+	}
+
+	kfree(jobs);
+	return ret;
+
+sequential:
+	if (enable)
+		return fpga_region_interfaces_enable(interface_list);
+	else
+		return fpga_region_interfaces_disable(interface_list);
+}
+
+/**
+ * fpga_region_interfaces_enable_parallel - enable fpga region interfaces concurrently
+ *
+ * @interface_list: list of fpga region interfaces
+ *
+ * Enable the interfaces in the list concurrently, so that slow operations
+ * such as waiting for a PLL to lock overlap.  An interface that lists other
+ * interfaces in its "interface-depends" property is enabled only after them,
+ * as fpga_region_interfaces_enable() does.
+ *
+ * Return 0 for success or empty interface list; return error code otherwise.
+ */
+int fpga_region_interfaces_enable_parallel(struct list_head* interface_list)
+{
+	return fpga_region_interfaces_set_parallel(interface_list, true);
+}
+EXPORT_SYMBOL_GPL(fpga_region_interfaces_enable_parallel);
+
+/**
+ * fpga_region_interfaces_disable_parallel - disable fpga region interfaces concurrently
+ *
+ * @interface_list: list of fpga region interfaces
+ *
+ * Disable the interfaces in the list concurrently.  An interface is
+ * disabled before the interfaces listed in its "interface-depends" property.
+ *
+ * Return 0 for success or empty interface list; return error code otherwise.
+ */
+int fpga_region_interfaces_disable_parallel(struct list_head* interface_list)
+{
+	return fpga_region_interfaces_set_parallel(interface_list, false);
+}
+EXPORT_SYMBOL_GPL(fpga_region_interfaces_disable_parallel);
+
 /**
  * fpga_region_interfaces_of_setup - setup fpga region interfaces in a list
  *
  * @interface_list: list of fpga region interfaces
  * @np: node pointer of device tree
  *
- * Setup each interface in the list.  If list is empty, do nothing.
+ * Setup each interface in the list that has a child node of the same name
+ * in @np.  Only the children of @np are looked at, once each, so the cost
+ * does not depend on the size of the rest of the device tree.  If list is
+ * empty, do nothing.
  *
  * Return 0 for success or empty interface list; return error code otherwise.
  */
 int fpga_region_interfaces_of_setup(struct list_head* interface_list, struct device_node* np)
 {
 	struct fpga_region_interface* interface;
+	struct device_node*           child;
 	int ret;
 
-	list_for_each_entry(interface, interface_list, node) {
-		ret = fpga_region_interface_of_setup(interface, np);
-		if (ret)
-			return ret;
+	if (!np || list_empty(interface_list))
+		return 0;
+
+	for_each_child_of_node(np, child) {
+		list_for_each_entry(interface, interface_list, node) {
+			if (!fpga_region_interface_of_match(interface, child))
+				continue;
+
+			dev_dbg(&interface->dev, "setup\n");
+			ret = interface->ops->of_setup(interface, child);
+			if (ret) {
+				of_node_put(child);
+				return ret;
+			}
+		}
 	}
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(fpga_region_interfaces_of_setup);
 
+/**
+ * fpga_region_interfaces_of_update - change the setup of enabled fpga region interfaces
+ *
+ * @interface_list: list of fpga region interfaces
+ * @np: node pointer of device tree
+ *
+ * Like fpga_region_interfaces_of_setup(), and the new setup is applied at
+ * once to each interface that has a child node of the same name in @np,
+ * without disabling it.  Interfaces without such a child node are not
+ * touched.  An interface that has no update operation keeps the new setup
+ * for the next time it is enabled.
+ *
+ * Every child node is checked with the of_check operation before any
+ * interface is changed, so that a node one interface rejects does not leave
+ * the interfaces before it updated.  Only a failure of the hardware while
+ * an interface is updated can still leave the update partly applied.
+ *
+ * Return 0 for success or empty interface list; return error code otherwise.
+ */
+int fpga_region_interfaces_of_update(struct list_head* interface_list, struct device_node* np)
+{
+	struct fpga_region_interface* interface;
+	struct device_node*           child;
+	int ret;
+
+	if (!np || list_empty(interface_list))
+		return 0;
+
+	for_each_child_of_node(np, child) {
+		list_for_each_entry(interface, interface_list, node) {
+			if (!fpga_region_interface_of_match(interface, child))
+				continue;
+			if (!interface->ops->of_check)
+				continue;
+
+			ret = interface->ops->of_check(interface, child);
+			if (ret) {
+				dev_err(&interface->dev, "invalid update %pOF\n", child);
+				of_node_put(child);
+				return ret;
+			}
+		}
+	}
+
+	for_each_child_of_node(np, child) {
+		list_for_each_entry(interface, interface_list, node) {
+			if (!fpga_region_interface_of_match(interface, child))
+				continue;
+
+			dev_dbg(&interface->dev, "update\n");
+			ret = interface->ops->of_setup(interface, child);
+			if (!ret && interface->ops->update)
+				ret = interface->ops->update(interface);
+			if (ret) {
+				of_node_put(child);
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fpga_region_interfaces_of_update);
+
 /**
  * fpga_region_interfaces_put - put fpga region interfaces
  *
@@ -270,24 +602,102 @@ EXPORT_SYMBOL_GPL(fpga_region_interfaces_of_setup);
  *
  * For each interface in the list, put the interface and remove it from the list.
  * If list is empty, do nothing.
+ *
+ * The list is owned by its caller, which must serialize access to it (the
+ * fpga region core does so with the region mutex).
  */
 void fpga_region_interfaces_put(struct list_head* interface_list)
 {
 	struct fpga_region_interface *interface, *next;
-	unsigned long flags;
 
 	list_for_each_entry_safe(interface, next, interface_list, node) {
 		if (interface->dev.class == fpga_region_interface_class)
 			fpga_region_interface_put(interface);
 		else
 			fpga_bridge_put((struct fpga_bridge*)interface);
-		spin_lock_irqsave(&fpga_region_interface_list_lock, flags);
 		list_del(&interface->node);
-		spin_unlock_irqrestore(&fpga_region_interface_list_lock, flags);
 	}
 }
 EXPORT_SYMBOL_GPL(fpga_region_interfaces_put);
 
+/**
+ * fpga_region_interfaces_order - order an interface list by "interface-depends"
+ *
+ * @interface_list: list of FPGA region interfaces
+ * @added: entry that was just added to the list
+ *
+ * An interface depends on the interfaces listed in the "interface-depends"
+ * property of its device node.  Dependencies on interfaces that are not in
+ * the list are ignored.  Interfaces without dependencies get level 0, and
+ * every other interface gets one more than the highest level it depends
+ * on.  The list is then sorted by level, keeping the order of the
+ * interfaces within a level, so that walking it forwards enables
+ * dependencies first and walking it backwards disables them last.
+ *
+ * If the dependencies have a cycle, which must go through @added, @added
+ * is removed from the list again and put.
+ *
+ * Return 0 for success or -EINVAL if the dependencies have a cycle.
+ */
+static int fpga_region_interfaces_order(
+	struct list_head*             interface_list,
+	struct fpga_region_interface* added)
+{
+	struct fpga_region_interface* interface;
+	struct fpga_region_interface* dep;
+	struct fpga_region_interface* next;
+	struct device_node*           np;
+	LIST_HEAD(sorted);
+	bool changed = true;
+	int  count   = 0;
+	int  levels  = 0;
+	int  pass, level, i;
+
+	list_for_each_entry(interface, interface_list, node) {
+		if (interface->dev.class == fpga_region_interface_class)
+			interface->level = 0;
+		count++;
+	}
+
+	/* A level never exceeds count - 1 unless there is a cycle. */
+	for (pass = 0; changed; pass++) {
+		if (pass > count) {
+			pr_err("%s: interface-depends of %s has a cycle\n",
+			       __func__, added->name);
+			list_del(&added->node);
+			fpga_region_interface_put(added);
+			return -EINVAL;
+		}
+		changed = false;
+		list_for_each_entry(interface, interface_list, node) {
+			if (interface->dev.class != fpga_region_interface_class)
+				continue;
+			for (i = 0; (np = of_parse_phandle(interface->dev.of_node,
+							   "interface-depends", i)); i++) {
+				list_for_each_entry(dep, interface_list, node) {
+					if (dep->dev.of_node != np ||
+					    fpga_region_interface_level(dep) < interface->level)
+						continue;
+					interface->level = fpga_region_interface_level(dep) + 1;
+					changed = true;
+				}
+				of_node_put(np);
+			}
+			levels = max(levels, interface->level + 1);
+		}
+	}
+
+	for (level = 0; level < levels; level++) {
+		list_for_each_entry_safe(interface, next, interface_list, node) {
+			if (fpga_region_interface_level(interface) == level)
+				list_move_tail(&interface->node, &sorted);
+		}
+	}
+	list_splice(&sorted, interface_list);
+
+	return 0;
+}
+
 /**
  * of_fpga_region_interface_get_to_list - get a fpga region interface, add it to a list
  *
@@ -296,8 +706,13 @@ EXPORT_SYMBOL_GPL(fpga_region_interfaces_put);
  * @interface_list: list of FPGA region_interfaces
  *
  * Get an exclusive reference to the fpga region interface and and it to the list.
+ * If @np is not a registered fpga region interface, look for a fpga bridge.
+ * The list is kept ordered by "interface-depends", see
+ * fpga_region_interfaces_order().  The caller must serialize access to
+ * @interface_list.
  *
- * Return 0 for success, error code from of_fpga_region_interface_get() othewise.
+ * Return 0 for success, -EINVAL if "interface-depends" has a cycle, error
+ * code from of_fpga_region_interface_get() othewise.
  */
 int of_fpga_region_interface_get_to_list(
 	struct device_node *np,
@@ -306,20 +721,19 @@ int of_fpga_region_interface_get_to_list(
 {
 	struct fpga_region_interface* interface;
 	struct fpga_bridge*           bridge;
-	unsigned long                 flags;
 
 	interface = of_fpga_region_interface_get(np, info);
 	if (!IS_ERR(interface)) {
-		spin_lock_irqsave(&fpga_region_interface_list_lock, flags);
 		list_add_tail(&interface->node, interface_list);
-		spin_unlock_irqrestore(&fpga_region_interface_list_lock, flags);
-		return 0;
+		return fpga_region_interfaces_order(interface_list, interface);
         }
+	/* @np is a registered interface, but it is in use. */
+	if (PTR_ERR(interface) != -ENODEV)
+		return PTR_ERR(interface);
+
 	bridge = of_fpga_bridge_get(np, info);
 	if (!IS_ERR(bridge)) {
-		spin_lock_irqsave(&fpga_region_interface_list_lock, flags);
 		list_add_tail(&bridge->node, interface_list);
-		spin_unlock_irqrestore(&fpga_region_interface_list_lock, flags);
 		return 0;
         }
 	return PTR_ERR(bridge);
@@ -334,8 +748,12 @@ EXPORT_SYMBOL_GPL(of_fpga_region_interface_get_to_list);
  * @interface_list: list of FPGA region_interfaces
  *
  * Get an exclusive reference to the region_interface and and it to the list.
+ * The list is kept ordered by "interface-depends", see
+ * fpga_region_interfaces_order().  The caller must serialize access to
+ * @interface_list.
  *
- * Return 0 for success, error code from fpga_region_interface_get() othewise.
+ * Return 0 for success, -EINVAL if "interface-depends" has a cycle, error
+ * code from fpga_region_interface_get() othewise.
  */
 int fpga_region_interface_get_to_list(
 	struct device *dev,
@@ -344,20 +762,15 @@ int fpga_region_interface_get_to_list(
 {
 	struct fpga_region_interface* interface;
 	struct fpga_bridge*           bridge;
-	unsigned long                 flags;
 
 	interface = fpga_region_interface_get(dev, info);
 	if (!IS_ERR(interface)) {
-		spin_lock_irqsave(&fpga_region_interface_list_lock, flags);
 		list_add_tail(&interface->node, interface_list);
-		spin_unlock_irqrestore(&fpga_region_interface_list_lock, flags);
-		return 0;
+		return fpga_region_interfaces_order(interface_list, interface);
         }
 	bridge = fpga_bridge_get(dev, info);
 	if (!IS_ERR(bridge)) {
-		spin_lock_irqsave(&fpga_region_interface_list_lock, flags);
 		list_add_tail(&bridge->node, interface_list);
-		spin_unlock_irqrestore(&fpga_region_interface_list_lock, flags);
 		return 0;
         }
 	return PTR_ERR(bridge);
@@ -432,6 +845,7 @@ struct fpga_region_interface *fpga_region_interface_create(
 
 	mutex_init(&interface->mutex);
 	INIT_LIST_HEAD(&interface->node);
+	INIT_HLIST_NODE(&interface->index_node);
 
 	interface->name = name;
 	interface->ops  = ops;
@@ -538,6 +952,14 @@ int fpga_region_interface_register(struct fpga_region_interface *interface)
 	if (ret)
 		return ret;
 
+	if (dev->of_node) {
+		spin_lock(&fpga_region_interface_index_lock);
+		hash_add(fpga_region_interface_index, &interface->index_node,
+			 (unsigned long)dev->of_node);
+		spin_unlock(&fpga_region_interface_index_lock);
+	}
+	atomic_long_inc(&fpga_region_interface_generation_count);
+
 	of_platform_populate(dev->of_node, NULL, NULL, dev);
 
 	dev_info(dev->parent, "fpga region interface [%s] registered\n", interface->name);
@@ -562,6 +984,12 @@ void fpga_region_interface_unregister(struct fpga_region_interface* interface)
 	if (interface->ops && interface->ops->remove)
 		interface->ops->remove(interface);
 
+	spin_lock(&fpga_region_interface_index_lock);
+	if (!hlist_unhashed(&interface->index_node))
+		hash_del(&interface->index_node);
+	spin_unlock(&fpga_region_interface_index_lock);
+	atomic_long_inc(&fpga_region_interface_generation_count);
+
 	device_unregister(&interface->dev);
 }
 EXPORT_SYMBOL_GPL(fpga_region_interface_unregister);
@@ -572,8 +1000,6 @@ static void fpga_region_interface_dev_release(struct device *dev)
 
 static int __init fpga_region_interface_module_init(void)
 {
-	spin_lock_init(&fpga_region_interface_list_lock);
-
 	fpga_region_interface_class = class_create(THIS_MODULE, "fpga_region_interface");
 	if (IS_ERR(fpga_region_interface_class))
 		return PTR_ERR(fpga_region_interface_class);
@@ -8,11 +8,37 @@
 
 struct fpga_region_interface;
 
+#define FPGA_REGION_INTERFACE_SETTING_RATE	BIT(0)
+#define FPGA_REGION_INTERFACE_SETTING_ENABLE	BIT(1)
+#define FPGA_REGION_INTERFACE_SETTING_RESOURCE	BIT(2)
+
+/**
+ * struct fpga_region_interface_setting - setting of an interface for a region
+ * @flags: FPGA_REGION_INTERFACE_SETTING_* flags of the valid members
+ * @rate: rate while the region is operating, as "region-rate"
+ * @enable: enable while the region is operating, as "region-enable"
+ * @resource: resource index while the region is operating, as "region-resource"
+ *
+ * The same settings that of_setup() reads from a device tree node, for
+ * callers that program a region without a device tree overlay.
+ */
+struct fpga_region_interface_setting {
+	unsigned int flags;
+	unsigned long rate;
+	bool enable;
+	unsigned int resource;
+};
+
 /**
  * struct fpga_region_interface_ops - ops for low level FPGA regsion interface drivers
  * @enable_show: returns the FPGA region interface's status
  * @enable_set: set a FPGA region interface as enabled or disabled
  * @of_setup: setup a FPGA region interface by device tree node
+ * @of_check: optional, check that of_setup() would accept a device tree node,
+ *            including the transition it resolves, without changing anything
+ * @setup: setup a FPGA region interface by struct fpga_region_interface_setting
+ * @update: apply the settings of the last of_setup() or setup() to a FPGA
+ *          region interface that is enabled, changing only what differs
  * @fpga_region_interface_remove: set FPGA into a specific state during driver remove
  * @groups: optional attribute groups.
  */
@@ -20,6 +46,10 @@ struct fpga_region_interface_ops {
 	int (*enable_show)(struct fpga_region_interface *bridge);
 	int (*enable_set)(struct fpga_region_interface *bridge, bool enable);
 	int (*of_setup)(struct fpga_region_interface *bridge, struct device_node* np);
+	int (*of_check)(struct fpga_region_interface *bridge, struct device_node* np);
+	int (*setup)(struct fpga_region_interface *bridge,
+		     const struct fpga_region_interface_setting *setting);
+	int (*update)(struct fpga_region_interface *bridge);
 	void (*remove)(struct fpga_region_interface *bridge);
 	const struct attribute_group **groups;
 };
@@ -33,6 +63,13 @@ struct fpga_region_interface_ops {
  * @info: fpga image specific information
  * @node: FPGA region interface list node
  * @priv: low level driver private date
+ * @index_node: entry in the device_node index of registered interfaces
+ * @level: depth in the "interface-depends" graph of the list the interface
+ *         is on, set by the get_to_list functions
+ *
+ * Lists of interfaces may also contain struct fpga_bridge, which shares the
+ * members up to @priv.  Members after @priv are only valid for devices of
+ * the fpga_region_interface class.
  */
 struct fpga_region_interface {
 	const char *name;
@@ -42,6 +79,8 @@ struct fpga_region_interface {
 	struct fpga_image_info *info;
 	struct list_head node;
 	void *priv;
+	struct hlist_node index_node;
+	int level;
 };
 
 #define to_fpga_region_interface(d) container_of(d, struct fpga_region_interface, dev)
@@ -54,10 +93,15 @@ void fpga_region_interface_put(struct fpga_region_interface *bridge);
 int fpga_region_interface_enable(struct fpga_region_interface *bridge);
 int fpga_region_interface_disable(struct fpga_region_interface *bridge);
 int fpga_region_interface_of_setup(struct fpga_region_interface* interface, struct device_node* np);
+int fpga_region_interface_setup(struct fpga_region_interface* interface,
+				const struct fpga_region_interface_setting* setting);
 
 int fpga_region_interfaces_enable(struct list_head *bridge_list);
 int fpga_region_interfaces_disable(struct list_head *bridge_list);
+int fpga_region_interfaces_enable_parallel(struct list_head *bridge_list);
+int fpga_region_interfaces_disable_parallel(struct list_head *bridge_list);
 int fpga_region_interfaces_of_setup(struct list_head* interface_list, struct device_node* np);
+int fpga_region_interfaces_of_update(struct list_head* interface_list, struct device_node* np);
 void fpga_region_interfaces_put(struct list_head *bridge_list);
 int fpga_region_interface_get_to_list(struct device *dev,
 			    struct fpga_image_info *info,
@@ -65,6 +109,7 @@ int fpga_region_interface_get_to_list(struct device *dev,
 int of_fpga_region_interface_get_to_list(struct device_node *np,
 			       struct fpga_image_info *info,
 			       struct list_head *bridge_list);
+unsigned long fpga_region_interface_generation(void);
 
 struct fpga_region_interface *fpga_region_interface_create(struct device *dev, const char *name,
 				       const struct fpga_region_interface_ops *ops,
@@ -6,16 +6,22 @@
  *  Copyright (C) 2017 Intel Corporation
  *  Copyright (C) 2020 Ichiro Kawazome
  */
+#include <linux/async.h>
 #include <linux/fpga/fpga-mgr.h>
 #include <linux/idr.h>
+#include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of_platform.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/uaccess.h>
 #include "fpga-region-core.h"
 #include "fpga-region-interface.h"
+#include "fpga-region-manager.h"
 
 static const struct of_device_id fpga_region_manager_of_match[] = {
 	{ .compatible = "ikwzm,fpga-region-manager", },
@@ -23,6 +29,50 @@ static const struct of_device_id fpga_region_manager_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, fpga_region_manager_of_match);
 
+/**
+ * struct fpga_region_manager_interface_cache - interfaces resolved from device tree
+ * @nodes: device nodes of the interfaces resolved for the region
+ * @count: number of entries in @nodes
+ * @generation: fpga_region_interface_generation() when @nodes was resolved
+ * @valid: @nodes can be reused
+ */
+struct fpga_region_manager_interface_cache {
+	struct device_node **nodes;
+	int count;
+	unsigned long generation;
+	bool valid;
+};
+
+/**
+ * struct fpga_region_manager_priv - fpga region manager private data
+ * @interfaces: interfaces of the region, used for full reconfiguration
+ * @partial_interfaces: interfaces of the "partial-fpga-bridges" property,
+ *                      used for partial reconfiguration
+ * @region: FPGA region
+ * @misc: character device of the region
+ * @ioctl_lock: serializes the ioctls of @misc
+ * @settings: interface settings of the image programmed through @misc
+ * @setting_count: number of entries in @settings
+ * @populate_deferred: the devices of the overlay are populated once its
+ *                     asynchronous programming succeeds
+ */
+struct fpga_region_manager_priv {
+	struct fpga_region_manager_interface_cache interfaces;
+	struct fpga_region_manager_interface_cache partial_interfaces;
+	struct fpga_region_core*  region;
+	struct miscdevice         misc;
+	struct mutex              ioctl_lock;
+	struct fpga_region_manager_interface* settings;
+	int                       setting_count;
+	bool                      populate_deferred;
+};
+
+/*
+ * Serializes setting and clearing region->info between the overlay notifier
+ * and the character devices.
+ */
+static DEFINE_MUTEX(fpga_region_manager_lock);
+
 /**
  * fpga_region_manager_find - find FPGA region
  * @np: device node of FPGA Region
@@ -33,7 +83,7 @@ MODULE_DEVICE_TABLE(of, fpga_region_manager_of_match);
  */
 static struct fpga_region_core *fpga_region_manager_find(struct device_node *np)
 {
-	return fpga_region_core_class_find(NULL, np, device_match_of_node);
+	return fpga_region_core_find_by_of_node(np);
 }
 
 /**
@@ -70,50 +120,83 @@ static struct fpga_manager *fpga_region_manager_get_mgr(struct device_node *np)
 }
 
 /**
- * fpga_region_manager_get_interfaces - create a list of bridges
+ * fpga_region_manager_invalidate_interfaces - drop the cached interface nodes
+ * @cache: interface cache
+ */
+static void fpga_region_manager_invalidate_interfaces(struct fpga_region_manager_interface_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++)
+		of_node_put(cache->nodes[i]);
+	kfree(cache->nodes);
+	cache->nodes = NULL;
+	cache->count = 0;
+	cache->valid = false;
+}
+
+/**
+ * fpga_region_manager_resolve_interfaces - create a list of bridges from device tree
  * @region: FPGA region
+ * @np: node that has the @propname property
+ * @propname: name of the property that lists the bridges
+ * @parent: also add the parent of the region if it is a bridge
+ * @cache: remember the nodes that were resolved for the next programming,
+ *         or NULL
  *
- * Create a list of bridges including the parent bridge and the bridges
- * specified by "fpga-bridges" property.  Note that the
- * fpga_bridges_enable/disable/put functions are all fine with an empty list
- * if that happens.
+ * Add the parent bridge and the bridges specified by the @propname property
+ * of @np to region->interface_list.
  *
- * Caller should call fpga_bridges_put(&region->interface_list) when
- * done with the bridges.
+ * Nodes that are neither a fpga region interface nor a fpga bridge are
+ * skipped.
  *
- * Return 0 for success (even if there are no bridges specified)
- * or -EBUSY if any of the bridges are in use.
+ * Return 0 for success (even if there are no bridges specified),
+ * -EBUSY if any of the bridges are in use, or -EINVAL if their
+ * "interface-depends" properties have a cycle.
  */
-static int fpga_region_manager_get_interfaces(struct fpga_region_core *region)
+static int fpga_region_manager_resolve_interfaces(
+	struct fpga_region_core*                     region,
+	struct device_node*                          np,
+	const char*                                  propname,
+	bool                                         parent,
+	struct fpga_region_manager_interface_cache*  cache)
 {
-	struct device *dev = &region->dev;
-	struct device_node *region_np = dev->of_node;
+	struct device_node *region_np = region->dev.of_node;
 	struct fpga_image_info *info = region->info;
-	struct device_node *br, *np, *parent_br = NULL;
+	struct device_node *br, *parent_br = NULL;
+	struct device_node **nodes = NULL;
+	unsigned long generation = 0;
+	int count = 0;
 	int i, ret;
 
+	if (cache) {
+		generation = fpga_region_interface_generation();
+		ret = of_count_phandle_with_args(np, propname, NULL);
+		nodes = kcalloc(1 + max(ret, 0), sizeof(*nodes), GFP_KERNEL);
+		if (!nodes)
+			return -ENOMEM;
+	}
+
 	/* If parent is a bridge, add to list */
-	ret = of_fpga_region_interface_get_to_list(region_np->parent, info, &region->interface_list);
+	ret = (parent) ? of_fpga_region_interface_get_to_list(region_np->parent, info,
+							      &region->interface_list)
+		       : -ENODEV;
 
-	/* -EBUSY means parent is a bridge that is under use. Give up. */
-	if (ret == -EBUSY)
+	/* -ENODEV means parent is not a bridge.  Give up on anything else. */
+	if (ret && ret != -ENODEV) {
+		kfree(nodes);
 		return ret;
+	}
 
 	/* Zero return code means parent was a bridge and was added to list. */
-	if (!ret)
+	if (!ret) {
 		parent_br = region_np->parent;
-
-	/* If overlay has a list of bridges, use it. */
-	br = of_parse_phandle(info->overlay, "fpga-bridges", 0);
-	if (br) {
-		of_node_put(br);
-		np = info->overlay;
-	} else {
-		np = region_np;
+		if (nodes)
+			nodes[count++] = of_node_get(parent_br);
 	}
 
 	for (i = 0; ; i++) {
-		br = of_parse_phandle(np, "fpga-bridges", i);
+		br = of_parse_phandle(np, propname, i);
 		if (!br)
 			break;
 
@@ -125,15 +208,172 @@ static int fpga_region_manager_get_interfaces(struct fpga_region_core *region)
 
 		/* If node is a bridge, get it and add to list */
 		ret = of_fpga_region_interface_get_to_list(br, info, &region->interface_list);
+		if (!ret && nodes)
+			nodes[count++] = of_node_get(br);
 		of_node_put(br);
 
 		/* If any of the bridges are in use, give up */
-		if (ret == -EBUSY) {
+		if (ret && ret != -ENODEV) {
+			fpga_region_interfaces_put(&region->interface_list);
+			while (count > 0)
+				of_node_put(nodes[--count]);
+			kfree(nodes);
+			return ret;
+		}
+	}
+
+	if (cache) {
+		cache->nodes      = nodes;
+		cache->count      = count;
+		cache->generation = generation;
+		cache->valid      = true;
+	}
+
+	return 0;
+}
+
+/**
+ * fpga_region_manager_get_cached_interfaces - create a list of bridges from the cache
+ * @region: FPGA region
+ * @cache: interface cache
+ *
+ * Return 0 for success, -ENODEV if the cache is missing or stale, or the
+ * error code of fpga_region_manager_resolve_interfaces().
+ */
+static int fpga_region_manager_get_cached_interfaces(
+	struct fpga_region_core*                     region,
+	struct fpga_region_manager_interface_cache*  cache)
+{
+	int i, ret;
+
+	if (!cache->valid ||
+	    cache->generation != fpga_region_interface_generation())
+		return -ENODEV;
+
+	for (i = 0; i < cache->count; i++) {
+		ret = of_fpga_region_interface_get_to_list(cache->nodes[i],
+							   region->info,
+							   &region->interface_list);
+		if (ret) {
 			fpga_region_interfaces_put(&region->interface_list);
-			return -EBUSY;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * fpga_region_manager_setup_interfaces - apply the settings of the character device
+ * @region: FPGA region
+ *
+ * Every setting is applied to the interfaces of region->interface_list that
+ * have its name.  Settings for interfaces that are not in the list are
+ * ignored, like child nodes of an overlay that match no interface.
+ *
+ * Return 0 for success or negative error code.
+ */
+static int fpga_region_manager_setup_interfaces(struct fpga_region_core *region)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+	struct fpga_region_interface *interface;
+	struct fpga_region_interface_setting setting;
+	int i, ret;
+
+	for (i = 0; i < priv->setting_count; i++) {
+		const struct fpga_region_manager_interface *arg = &priv->settings[i];
+
+		setting.flags    = 0;
+		setting.rate     = arg->rate;
+		setting.enable   = (arg->enable != 0);
+		setting.resource = arg->resource;
+		if (arg->flags & FPGA_REGION_MANAGER_INTERFACE_RATE)
+			setting.flags |= FPGA_REGION_INTERFACE_SETTING_RATE;
+		if (arg->flags & FPGA_REGION_MANAGER_INTERFACE_ENABLE)
+			setting.flags |= FPGA_REGION_INTERFACE_SETTING_ENABLE;
+		if (arg->flags & FPGA_REGION_MANAGER_INTERFACE_RESOURCE)
+			setting.flags |= FPGA_REGION_INTERFACE_SETTING_RESOURCE;
+
+		list_for_each_entry(interface, &region->interface_list, node) {
+			if (strcmp(interface->name, arg->name))
+				continue;
+			ret = fpga_region_interface_setup(interface, &setting);
+			if (ret)
+				return ret;
 		}
 	}
 
+	return 0;
+}
+
+/**
+ * fpga_region_manager_get_interfaces - create a list of bridges
+ * @region: FPGA region
+ *
+ * Create a list of bridges including the parent bridge and the bridges
+ * specified by "fpga-bridges" property.  Note that the
+ * fpga_bridges_enable/disable/put functions are all fine with an empty list
+ * if that happens.
+ *
+ * For partial reconfiguration, a region that has a "partial-fpga-bridges"
+ * property uses only the bridges listed there, without the parent bridge,
+ * so that the bridges of the static region and of sibling partitions are
+ * not disabled while the partition is loaded.
+ *
+ * The bridges resolved from the region node are cached, and reused as long
+ * as no fpga region interface has been registered or unregistered since.
+ * A "fpga-bridges" property in the overlay bypasses the cache.
+ *
+ * A region programmed through its character device has no overlay; the
+ * interface settings passed to the ioctl take the place of the overlay's
+ * child nodes.
+ *
+ * Caller should call fpga_bridges_put(&region->interface_list) when
+ * done with the bridges.
+ *
+ * Return 0 for success (even if there are no bridges specified)
+ * or -EBUSY if any of the bridges are in use.
+ */
+static int fpga_region_manager_get_interfaces(struct fpga_region_core *region)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+	struct fpga_region_manager_interface_cache *cache;
+	struct device *dev = &region->dev;
+	struct device_node *region_np = dev->of_node;
+	struct fpga_image_info *info = region->info;
+	struct device_node *br;
+	const char *propname;
+	bool parent;
+	int ret;
+
+	if ((info->flags & FPGA_MGR_PARTIAL_RECONFIG) &&
+	    of_property_read_bool(region_np, "partial-fpga-bridges")) {
+		cache    = &priv->partial_interfaces;
+		propname = "partial-fpga-bridges";
+		parent   = false;
+	} else {
+		cache    = &priv->interfaces;
+		propname = "fpga-bridges";
+		parent   = true;
+	}
+
+	/* If overlay has a list of bridges, use it. */
+	br = of_parse_phandle(info->overlay, "fpga-bridges", 0);
+	if (br) {
+		of_node_put(br);
+		ret = fpga_region_manager_resolve_interfaces(region, info->overlay,
+							     "fpga-bridges", true, NULL);
+	} else {
+		ret = fpga_region_manager_get_cached_interfaces(region, cache);
+		if (ret == -ENODEV) {
+			fpga_region_manager_invalidate_interfaces(cache);
+			ret = fpga_region_manager_resolve_interfaces(region, region_np,
+								     propname, parent, cache);
+		}
+	}
+	if (ret)
+		return ret;
+
         ret = fpga_region_interfaces_of_setup(&region->interface_list, region_np);
         if (ret) {
 		fpga_region_interfaces_put(&region->interface_list);
@@ -146,44 +386,68 @@ static int fpga_region_manager_get_interfaces(struct fpga_region_core *region)
 		return -EBUSY;
 	}
 
+	if (!info->overlay) {
+		ret = fpga_region_manager_setup_interfaces(region);
+		if (ret) {
+			fpga_region_interfaces_put(&region->interface_list);
+			return ret;
+		}
+	}
+
 	return 0;
 }
 
 /**
  * child_regions_with_firmware
- * @overlay: device node of the overlay
+ * @np: device node whose descendants are checked
  *
  * If the overlay adds child FPGA regions, they are not allowed to have
- * firmware-name property.
+ * firmware-name property.  Only the subtree below @np is walked, so the
+ * cost depends on the size of the overlay, not of the live tree.
  *
  * Return 0 for OK or -EINVAL if child FPGA region adds firmware-name.
  */
-static int child_regions_with_firmware(struct device_node *overlay)
+static int child_regions_with_firmware(struct device_node *np)
 {
-	struct device_node *child_region;
+	struct device_node *node;
+	struct device_node *next;
+	struct device_node *parent;
 	const char *child_firmware_name;
-	int ret = 0;
-
-	of_node_get(overlay);
 
-	child_region = of_find_matching_node(overlay, fpga_region_manager_of_match);
-	while (child_region) {
-		if (!of_property_read_string(child_region, "firmware-name",
+	node = of_get_next_child(np, NULL);
+	while (node) {
+		if (of_match_node(fpga_region_manager_of_match, node) &&
+		    !of_property_read_string(node, "firmware-name",
 					     &child_firmware_name)) {
-			ret = -EINVAL;
-			break;
+			pr_err("firmware-name not allowed in child FPGA region: %pOF",
+			       node);
+			of_node_put(node);
+			return -EINVAL;
 		}
-		child_region = of_find_matching_node(child_region,
-						     fpga_region_manager_of_match);
-	}
-
-	of_node_put(child_region);
 
-	if (ret)
-		pr_err("firmware-name not allowed in child FPGA region: %pOF",
-		       child_region);
+		/*
+		 * Depth first, without recursion: the first child, else the
+		 * next sibling of the node or of its nearest ancestor below @np.
+		 */
+		next = of_get_next_child(node, NULL);
+		if (next) {
+			of_node_put(node);
+			node = next;
+			continue;
+		}
+		for (;;) {
+			parent = of_get_parent(node);
+			next   = of_get_next_child(parent, node);
+			if (next || parent == np) {
+				of_node_put(parent);
+				break;
+			}
+			node = parent;
+		}
+		node = next;
+	}
 
-	return ret;
+	return 0;
 }
 
 /**
@@ -209,11 +473,6 @@ static struct fpga_image_info *fpga_region_manager_parse_overlay(
 	const char *firmware_name;
 	int ret;
 
-	if (region->info) {
-		dev_err(dev, "Region already has overlay applied.\n");
-		return ERR_PTR(-EINVAL);
-	}
-
 	/*
 	 * Reject overlay if child FPGA Regions added in the overlay have
 	 * firmware-name property (would mean that an FPGA region that has
@@ -259,8 +518,11 @@ static struct fpga_image_info *fpga_region_manager_parse_overlay(
 	of_property_read_u32(overlay, "config-complete-timeout-us",
 			     &info->config_complete_timeout_us);
 
-	/* If overlay is not programming the FPGA, don't need FPGA image info */
-	if (!info->firmware_name) {
+	/*
+	 * If overlay is not programming the FPGA, don't need FPGA image info.
+	 * "fpga-config-from-dmabuf" programs the image staged for the region.
+	 */
+	if (!info->firmware_name && !(info->flags & FPGA_MGR_CONFIG_DMA_BUF)) {
 		ret = 0;
 		goto ret_no_info;
 	}
@@ -275,12 +537,318 @@ static struct fpga_image_info *fpga_region_manager_parse_overlay(
 		goto ret_no_info;
 	}
 
+	if (region->info) {
+		dev_err(dev, "Region already has overlay applied.\n");
+		ret = -EINVAL;
+		goto ret_no_info;
+	}
+
+	/* Load the image even if the region already holds it. */
+	if (of_property_read_bool(overlay, "force-fpga-config"))
+		info->flags |= FPGA_REGION_CORE_CONFIG_FORCE;
+
 	return info;
 ret_no_info:
 	fpga_image_info_free(info);
 	return ERR_PTR(ret);
 }
 
+/**
+ * fpga_region_manager_restore_populate - let the OF core populate the region again
+ *
+ * @region: FPGA region
+ *
+ * Undoes the deferral of device population by an asynchronous overlay,
+ * without populating the devices of the overlay.
+ */
+static void fpga_region_manager_restore_populate(struct fpga_region_core *region)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+
+	if (priv->populate_deferred) {
+		of_node_set_flag(region->dev.of_node, OF_POPULATED_BUS);
+		priv->populate_deferred = false;
+	}
+}
+
+/**
+ * fpga_region_manager_program_done - asynchronous programming has finished
+ *
+ * @region: FPGA region
+ * @ret: result of programming
+ *
+ * Runs on the fpga_region_core workqueue, and must not take
+ * fpga_region_manager_lock, which is held while asynchronous programming is
+ * cancelled.  On success, creates the devices of the overlay that were held
+ * back by fpga_region_manager_notify_pre_apply().  On failure they stay
+ * unpopulated until the overlay is removed.
+ */
+static void fpga_region_manager_program_done(struct fpga_region_core *region, int ret)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+
+	if (ret || !priv->populate_deferred)
+		return;
+
+	priv->populate_deferred = false;
+	of_platform_populate(region->dev.of_node, fpga_region_manager_of_match,
+			     NULL, &region->dev);
+}
+
+/**
+ * fpga_region_manager_is_async - check if the region is programmed asynchronously
+ *
+ * @region: FPGA region
+ * @overlay: overlay applied to the FPGA region
+ *
+ * Asynchronous programming is requested by the "async-fpga-config" property
+ * in either the overlay or the region node.
+ */
+static bool fpga_region_manager_is_async(
+	struct fpga_region_core* region,
+	struct device_node*      overlay)
+{
+	return of_property_read_bool(overlay, "async-fpga-config") ||
+	       of_property_read_bool(region->dev.of_node, "async-fpga-config");
+}
+
+/**
+ * struct fpga_region_manager_batch_member - fragment programmed by a batch
+ * @region: FPGA region targeted by the fragment
+ * @overlay: overlay node of the fragment
+ * @info: FPGA image info parsed from @overlay
+ * @result: result of programming @region
+ */
+struct fpga_region_manager_batch_member {
+	struct fpga_region_core* region;
+	struct device_node*      overlay;
+	struct fpga_image_info*  info;
+	int  result;
+};
+
+/**
+ * fpga_region_manager_fragment_target - find the target of an overlay fragment
+ * @fragment: fragment node of an overlay
+ *
+ * Caller will need to of_node_put() the returned node.
+ *
+ * Returns the target node or NULL.
+ */
+static struct device_node *fpga_region_manager_fragment_target(struct device_node *fragment)
+{
+	const char *path;
+	u32 phandle;
+
+	if (!of_property_read_u32(fragment, "target", &phandle))
+		return of_find_node_by_phandle(phandle);
+	if (!of_property_read_string(fragment, "target-path", &path))
+		return of_find_node_by_path(path);
+
+	return NULL;
+}
+
+/**
+ * fpga_region_manager_batch_joins - check if a fragment can be programmed by a batch
+ * @region: FPGA region targeted by the fragment
+ * @overlay: overlay node of the fragment
+ *
+ * Only the overlay and the region node are looked at, so every fragment of
+ * an overlay computes the same batch.
+ */
+static bool fpga_region_manager_batch_joins(
+	struct fpga_region_core* region,
+	struct device_node*      overlay)
+{
+	if (fpga_region_manager_is_async(region, overlay))
+		return false;
+	if (of_property_read_bool(overlay, "external-fpga-config"))
+		return false;
+
+	return of_property_read_bool(overlay, "firmware-name") ||
+	       of_property_read_bool(overlay, "fpga-config-from-dmabuf");
+}
+
+/**
+ * fpga_region_manager_batch_put - release the members of a batch
+ * @members: members returned by fpga_region_manager_batch_get()
+ * @count: number of entries in @members
+ */
+static void fpga_region_manager_batch_put(
+	struct fpga_region_manager_batch_member* members,
+	int                                      count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		of_node_put(members[i].overlay);
+		put_device(&members[i].region->dev);
+	}
+	kfree(members);
+}
+
+/**
+ * fpga_region_manager_batch_get - find the fragments of an overlay programmed together
+ * @overlay: overlay node of the current fragment
+ * @count: returns the number of members
+ * @index: returns the index of the current fragment in the members
+ *
+ * Walks the fragments of the overlay in order.  A fragment is a member if
+ * fpga_region_manager_batch_joins() accepts it and its FPGA region sits
+ * behind a FPGA manager that no earlier member uses.
+ *
+ * Caller will need to fpga_region_manager_batch_put() the members.
+ *
+ * Returns the members in fragment order, or NULL if the current fragment is
+ * not a member or no other fragment is.
+ */
+static struct fpga_region_manager_batch_member *fpga_region_manager_batch_get(
+	struct device_node* overlay,
+	int*                count,
+	int*                index)
+{
+	struct fpga_region_manager_batch_member *members;
+	struct fpga_region_core *region;
+	struct device_node *fragment;
+	struct device_node *root;
+	struct device_node *child;
+	struct device_node *target;
+	struct device_node *np;
+	int size = 0;
+	int i;
+
+	fragment = of_get_parent(overlay);
+	root     = of_get_parent(fragment);
+	of_node_put(fragment);
+	if (!root)
+		return NULL;
+
+	for_each_child_of_node(root, child)
+		size++;
+
+	members = kcalloc(size, sizeof(*members), GFP_KERNEL);
+	if (!members)
+		goto err_put_root;
+
+	*count = 0;
+	*index = -1;
+	for_each_child_of_node(root, child) {
+		np = of_get_child_by_name(child, "__overlay__");
+		if (!np)
+			continue;
+
+		target = fpga_region_manager_fragment_target(child);
+		region = (target) ? fpga_region_manager_find(target) : NULL;
+		of_node_put(target);
+		if (!region || !fpga_region_manager_batch_joins(region, np))
+			goto next;
+
+		for (i = 0; i < *count; i++) {
+			if (members[i].region->mgr == region->mgr)
+				goto next;
+		}
+
+		if (np == overlay)
+			*index = *count;
+		members[*count].region  = region;
+		members[*count].overlay = np;
+		(*count)++;
+		continue;
+next:
+		if (region)
+			put_device(&region->dev);
+		of_node_put(np);
+	}
+	of_node_put(root);
+
+	if (*index < 0 || *count < 2) {
+		fpga_region_manager_batch_put(members, *count);
+		return NULL;
+	}
+
+	return members;
+
+err_put_root:
+	of_node_put(root);
+	return NULL;
+}
+
+static void fpga_region_manager_batch_func(void *data, async_cookie_t cookie)
+{
+	struct fpga_region_manager_batch_member *member = data;
+
+	member->result = fpga_region_core_program_fpga(member->region);
+}
+
+/**
+ * fpga_region_manager_batch_program - program the members of a batch concurrently
+ *
+ * @members: members of the batch, in fragment order
+ * @count: number of entries in @members
+ * @index: index of the current fragment in @members
+ * @info: FPGA image info parsed for the current fragment, always consumed
+ *
+ * The overlay core sends the pre-apply notifications of the fragments in
+ * order and stops at the first one that fails.  So every member but the
+ * last one is only checked, and nothing is programmed for it.  The last
+ * member knows that all the others have been accepted: it parses them
+ * again, then programs all of them, each on its own async worker, and
+ * joins them.  If any of them fails, the ones that succeeded are released
+ * again and the first error in fragment order rejects the overlay.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static int fpga_region_manager_batch_program(
+	struct fpga_region_manager_batch_member* members,
+	int                                      count,
+	int                                      index,
+	struct fpga_image_info*                  info)
+{
+	ASYNC_DOMAIN_EXCLUSIVE(domain);
+	int ret = 0;
+	int i;
+
+	fpga_image_info_free(info);
+	if (index != count - 1)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		info = fpga_region_manager_parse_overlay(members[i].region,
+							 members[i].overlay);
+		if (IS_ERR_OR_NULL(info)) {
+			ret = (info) ? PTR_ERR(info) : -EINVAL;
+			goto err_free_info;
+		}
+		members[i].info = info;
+	}
+
+	for (i = 0; i < count; i++) {
+		members[i].region->info = members[i].info;
+		async_schedule_domain(fpga_region_manager_batch_func,
+				      &members[i], &domain);
+	}
+	async_synchronize_full_domain(&domain);
+
+	for (i = 0; i < count; i++) {
+		if (members[i].result) {
+			ret = members[i].result;
+			break;
+		}
+	}
+	if (!ret)
+		return 0;
+
+	/* error; roll back every member and reject the overlay */
+	for (i = 0; i < count; i++) {
+		if (!members[i].result)
+			fpga_region_core_release_interfaces(members[i].region);
+		members[i].region->info = NULL;
+	}
+err_free_info:
+	for (i = 0; i < count; i++)
+		fpga_image_info_free(members[i].info);
+	return ret;
+}
+
 /**
  * fpga_region_manager_notify_pre_apply - pre-apply overlay notification
  *
@@ -293,6 +861,23 @@ ret_no_info:
  * If the checks fail, overlay is rejected and does not get added to the
  * live tree.
  *
+ * If asynchronous programming is requested, the overlay is accepted as soon
+ * as programming has been queued, and the result is reported through the
+ * status attribute of the region.  The devices of the overlay are not
+ * created until programming has succeeded, and not at all if it fails.
+ *
+ * Asynchronous programming waits for the region and its FPGA manager to
+ * become free instead of failing with -EBUSY.  "region-request-priority"
+ * and "region-request-timeout-ms" in the overlay control the wait.
+ *
+ * Otherwise the fragments of the overlay that program FPGA regions behind
+ * different FPGA managers are programmed concurrently, once the last of
+ * them is notified, see fpga_region_manager_batch_program().
+ *
+ * An overlay without "firmware-name" that targets a programmed region only
+ * changes the setup of its interfaces (e.g. "region-rate" of a fpga-clk),
+ * without loading the FPGA.  The change stays when the overlay is removed.
+ *
  * Returns 0 for success or negative error code for failure.
  */
 static int fpga_region_manager_notify_pre_apply(
@@ -307,17 +892,56 @@ static int fpga_region_manager_notify_pre_apply(
 	if (IS_ERR(info))
 		return PTR_ERR(info);
 
-	/* If overlay doesn't program the FPGA, accept it anyway. */
+	/*
+	 * If overlay doesn't program the FPGA, accept it anyway.  Its interface
+	 * settings are applied to a region that is programmed already.
+	 */
 	if (!info)
-		return 0;
+		return (region->info) ?
+			fpga_region_core_update_interfaces(region, nd->overlay) : 0;
 
 	if (region->info) {
 		dev_err(dev, "Region already has overlay applied.\n");
 		return -EINVAL;
 	}
 
+	if (!fpga_region_manager_is_async(region, nd->overlay)) {
+		struct fpga_region_manager_batch_member *members;
+		int count;
+		int index;
+
+		members = fpga_region_manager_batch_get(nd->overlay, &count, &index);
+		if (members) {
+			ret = fpga_region_manager_batch_program(members, count,
+								index, info);
+			fpga_region_manager_batch_put(members, count);
+			return ret;
+		}
+	}
+
 	region->info = info;
-	ret = fpga_region_core_program_fpga(region);
+	if (fpga_region_manager_is_async(region, nd->overlay)) {
+		struct fpga_region_manager_priv *priv = region->priv;
+		struct device_node *np = region->dev.of_node;
+		u32 priority   = 0;
+		u32 timeout_ms = 0;
+
+		/*
+		 * Keep the OF core from creating the devices of the overlay
+		 * while the FPGA is not programmed yet.  They are populated
+		 * by fpga_region_manager_program_done() on success.
+		 */
+		priv->populate_deferred = of_node_check_flag(np, OF_POPULATED_BUS);
+		of_node_clear_flag(np, OF_POPULATED_BUS);
+
+		of_property_read_u32(nd->overlay, "region-request-priority", &priority);
+		of_property_read_u32(nd->overlay, "region-request-timeout-ms", &timeout_ms);
+		ret = fpga_region_core_program_fpga_async(region, (int)priority, timeout_ms);
+		if (ret)
+			fpga_region_manager_restore_populate(region);
+	} else {
+		ret = fpga_region_core_program_fpga(region);
+	}
 	if (ret) {
 		/* error; reject overlay */
 		fpga_image_info_free(info);
@@ -327,6 +951,24 @@ static int fpga_region_manager_notify_pre_apply(
 	return ret;
 }
 
+/**
+ * fpga_region_manager_notify_pre_remove - pre-remove overlay notification
+ *
+ * @region: FPGA region that is targeted by the overlay that is being removed
+ * @nd: overlay notification data
+ *
+ * Cancels asynchronous programming of the overlay that is still waiting, or
+ * waits for it to finish, so that its devices are not populated while the
+ * overlay is being removed.
+ */
+static void fpga_region_manager_notify_pre_remove(
+	struct fpga_region_core*       region,
+	struct of_overlay_notify_data* nd)
+{
+	if (region->info && region->info->overlay == nd->overlay)
+		fpga_region_core_program_cancel(region);
+}
+
 /**
  * fpga_region_manager_notify_post_remove - post-remove overlay notification
  *
@@ -334,14 +976,19 @@ static int fpga_region_manager_notify_pre_apply(
  * @nd: overlay notification data
  *
  * Called after an overlay has been removed if the overlay's target was a
- * FPGA region.
+ * FPGA region.  Cancels asynchronous programming of the overlay that is
+ * still waiting, or waits for it to finish, before releasing the region.
+ * Nothing is done if the region was not programmed by this overlay.
  */
 static void fpga_region_manager_notify_post_remove(
 	struct fpga_region_core*       region,
 	struct of_overlay_notify_data* nd)
 {
-	fpga_region_interfaces_disable(&region->interface_list);
-	fpga_region_interfaces_put(&region->interface_list);
+	if (!region->info || region->info->overlay != nd->overlay)
+		return;
+
+	fpga_region_core_release_interfaces(region);
+	fpga_region_manager_restore_populate(region);
 	fpga_image_info_free(region->info);
 	region->info = NULL;
 }
@@ -373,7 +1020,7 @@ static int fpga_region_manager_notify(struct notifier_block *nb,
 		return NOTIFY_OK;       /* not for us */
 	case OF_OVERLAY_PRE_REMOVE:
 		pr_debug("%s OF_OVERLAY_PRE_REMOVE\n", __func__);
-		return NOTIFY_OK;       /* not for us */
+		break;
 	case OF_OVERLAY_POST_REMOVE:
 		pr_debug("%s OF_OVERLAY_POST_REMOVE\n", __func__);
 		break;
@@ -386,15 +1033,21 @@ static int fpga_region_manager_notify(struct notifier_block *nb,
 		return NOTIFY_OK;
 
 	ret = 0;
+	mutex_lock(&fpga_region_manager_lock);
 	switch (action) {
 	case OF_OVERLAY_PRE_APPLY:
 		ret = fpga_region_manager_notify_pre_apply(region, nd);
 		break;
 
+	case OF_OVERLAY_PRE_REMOVE:
+		fpga_region_manager_notify_pre_remove(region, nd);
+		break;
+
 	case OF_OVERLAY_POST_REMOVE:
 		fpga_region_manager_notify_post_remove(region, nd);
 		break;
 	}
+	mutex_unlock(&fpga_region_manager_lock);
 
 	put_device(&region->dev);
 
@@ -408,14 +1061,230 @@ static struct notifier_block fpga_region_manager_of_nb = {
 	.notifier_call = fpga_region_manager_notify,
 };
 
+/**
+ * fpga_region_manager_ioctl_program - program the region from the character device
+ * @region: FPGA region
+ * @argp: user pointer to struct fpga_region_manager_program
+ *
+ * Builds the FPGA image info from the ioctl argument instead of an overlay,
+ * and programs the region the way an overlay with "firmware-name" would.
+ * The region stays programmed until FPGA_REGION_MANAGER_IOCTL_REMOVE.
+ *
+ * Returns 0 for success or negative error code.
+ */
+static long fpga_region_manager_ioctl_program(
+	struct fpga_region_core* region,
+	void __user*             argp)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+	struct fpga_region_manager_program arg;
+	struct fpga_region_manager_interface *settings = NULL;
+	struct device *dev = &region->dev;
+	struct fpga_image_info *info;
+	const u32 flags = FPGA_REGION_MANAGER_PROGRAM_PARTIAL   |
+			  FPGA_REGION_MANAGER_PROGRAM_ENCRYPTED |
+			  FPGA_REGION_MANAGER_PROGRAM_ASYNC     |
+			  FPGA_REGION_MANAGER_PROGRAM_STAGED    |
+			  FPGA_REGION_MANAGER_PROGRAM_FORCE;
+	long ret;
+	u32 i;
+
+	if (copy_from_user(&arg, argp, sizeof(arg)))
+		return -EFAULT;
+
+	if ((arg.flags & ~flags) || arg.reserved ||
+	    arg.num_interfaces > FPGA_REGION_MANAGER_INTERFACES_MAX)
+		return -EINVAL;
+
+	if (!arg.firmware_name[0] && !(arg.flags & FPGA_REGION_MANAGER_PROGRAM_STAGED))
+		return -EINVAL;
+	if (strnlen(arg.firmware_name, sizeof(arg.firmware_name)) == sizeof(arg.firmware_name))
+		return -ENAMETOOLONG;
+
+	if (arg.num_interfaces) {
+		settings = memdup_user(u64_to_user_ptr(arg.interfaces),
+				       arg.num_interfaces * sizeof(*settings));
+		if (IS_ERR(settings))
+			return PTR_ERR(settings);
+
+		for (i = 0; i < arg.num_interfaces; i++) {
+			if (settings[i].reserved) {
+				ret = -EINVAL;
+				goto err_free_settings;
+			}
+			settings[i].name[sizeof(settings[i].name) - 1] = '\0';
+		}
+	}
+
+	info = fpga_image_info_alloc(dev);
+	if (!info) {
+		ret = -ENOMEM;
+		goto err_free_settings;
+	}
+
+	if (arg.firmware_name[0]) {
+		info->firmware_name = devm_kstrdup(dev, arg.firmware_name, GFP_KERNEL);
+		if (!info->firmware_name) {
+			ret = -ENOMEM;
+			goto err_free_info;
+		}
+	}
+	if (arg.flags & FPGA_REGION_MANAGER_PROGRAM_STAGED)
+		info->flags |= FPGA_MGR_CONFIG_DMA_BUF;
+	if (arg.flags & FPGA_REGION_MANAGER_PROGRAM_PARTIAL)
+		info->flags |= FPGA_MGR_PARTIAL_RECONFIG;
+	if (arg.flags & FPGA_REGION_MANAGER_PROGRAM_ENCRYPTED)
+		info->flags |= FPGA_MGR_ENCRYPTED_BITSTREAM;
+	if (arg.flags & FPGA_REGION_MANAGER_PROGRAM_FORCE)
+		info->flags |= FPGA_REGION_CORE_CONFIG_FORCE;
+	info->enable_timeout_us          = arg.enable_timeout_us;
+	info->disable_timeout_us         = arg.disable_timeout_us;
+	info->config_complete_timeout_us = arg.config_complete_timeout_us;
+
+	mutex_lock(&fpga_region_manager_lock);
+	if (region->info) {
+		mutex_unlock(&fpga_region_manager_lock);
+		dev_err(dev, "Region already has overlay applied.\n");
+		ret = -EBUSY;
+		goto err_free_info;
+	}
+	region->info         = info;
+	priv->settings       = settings;
+	priv->setting_count  = arg.num_interfaces;
+	mutex_unlock(&fpga_region_manager_lock);
+
+	if (arg.flags & FPGA_REGION_MANAGER_PROGRAM_ASYNC)
+		ret = fpga_region_core_program_fpga_async(region, arg.priority,
+							  arg.request_timeout_ms);
+	else
+		ret = fpga_region_core_program_fpga(region);
+	if (!ret)
+		return 0;
+
+	mutex_lock(&fpga_region_manager_lock);
+	region->info        = NULL;
+	priv->settings      = NULL;
+	priv->setting_count = 0;
+	mutex_unlock(&fpga_region_manager_lock);
+err_free_info:
+	fpga_image_info_free(info);
+err_free_settings:
+	kfree(settings);
+	return ret;
+}
+
+/**
+ * fpga_region_manager_ioctl_remove - release the region programmed by the character device
+ * @region: FPGA region
+ *
+ * fpga_region_manager_lock is held throughout, so an overlay can't take the
+ * region while it is being released.
+ *
+ * Returns 0 for success or -EINVAL if the region was not programmed through
+ * its character device.
+ */
+static long fpga_region_manager_ioctl_remove(struct fpga_region_core *region)
+{
+	struct fpga_region_manager_priv *priv = region->priv;
+	struct fpga_image_info *info;
+
+	mutex_lock(&fpga_region_manager_lock);
+	info = region->info;
+	if (!info || info->overlay) {
+		mutex_unlock(&fpga_region_manager_lock);
+		return -EINVAL;
+	}
+
+	fpga_region_core_release_interfaces(region);
+	region->info = NULL;
+	kfree(priv->settings);
+	priv->settings      = NULL;
+	priv->setting_count = 0;
+	mutex_unlock(&fpga_region_manager_lock);
+
+	fpga_image_info_free(info);
+
+	return 0;
+}
+
+/**
+ * fpga_region_manager_ioctl_stage_image - stage an image from the character device
+ * @region: FPGA region
+ * @argp: user pointer to struct fpga_region_manager_image
+ *
+ * Returns 0 for success or negative error code.
+ */
+static long fpga_region_manager_ioctl_stage_image(
+	struct fpga_region_core* region,
+	void __user*             argp)
+{
+	struct fpga_region_manager_image arg;
+
+	if (copy_from_user(&arg, argp, sizeof(arg)))
+		return -EFAULT;
+
+	if (arg.flags & ~FPGA_REGION_MANAGER_IMAGE_DMABUF)
+		return -EINVAL;
+
+	if (arg.flags & FPGA_REGION_MANAGER_IMAGE_DMABUF)
+		return fpga_region_core_stage_dmabuf(region, arg.dmabuf_fd);
+
+	if (arg.size > SIZE_MAX)
+		return -EINVAL;
+
+	return fpga_region_core_stage_user(region, arg.addr, arg.size);
+}
+
+static long fpga_region_manager_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct fpga_region_manager_priv *priv =
+		container_of(file->private_data, struct fpga_region_manager_priv, misc);
+	long ret;
+
+	mutex_lock(&priv->ioctl_lock);
+	switch (cmd) {
+	case FPGA_REGION_MANAGER_IOCTL_PROGRAM:
+		ret = fpga_region_manager_ioctl_program(priv->region, (void __user *)arg);
+		break;
+	case FPGA_REGION_MANAGER_IOCTL_REMOVE:
+		ret = fpga_region_manager_ioctl_remove(priv->region);
+		break;
+	case FPGA_REGION_MANAGER_IOCTL_STAGE_IMAGE:
+		ret = fpga_region_manager_ioctl_stage_image(priv->region, (void __user *)arg);
+		break;
+	case FPGA_REGION_MANAGER_IOCTL_UNSTAGE_IMAGE:
+		fpga_region_core_unstage(priv->region);
+		ret = 0;
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	mutex_unlock(&priv->ioctl_lock);
+
+	return ret;
+}
+
+static const struct file_operations fpga_region_manager_fops = {
+	.owner          = THIS_MODULE,
+	.unlocked_ioctl = fpga_region_manager_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
+	.llseek         = noop_llseek,
+};
+
 static int fpga_region_manager_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
 	struct device_node *np = dev->of_node;
+	struct fpga_region_manager_priv *priv;
 	struct fpga_region_core *region;
 	struct fpga_manager *mgr;
 	int ret;
 
+	priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
 	/* Find the FPGA mgr specified by region or parent region. */
 	mgr = fpga_region_manager_get_mgr(np);
 	if (IS_ERR(mgr))
@@ -427,10 +1296,29 @@ static int fpga_region_manager_probe(struct platform_device *pdev)
 		goto eprobe_mgr_put;
 	}
 
+	region->priv = priv;
+	region->program_done = fpga_region_manager_program_done;
+	region->parallel_interfaces = of_property_read_bool(np, "parallel-interfaces");
+
 	ret = fpga_region_core_register(region);
 	if (ret)
 		goto eprobe_mgr_put;
 
+	priv->region     = region;
+	priv->misc.minor = MISC_DYNAMIC_MINOR;
+	priv->misc.name  = devm_kasprintf(dev, GFP_KERNEL, "fpga-%s", dev_name(&region->dev));
+	priv->misc.fops  = &fpga_region_manager_fops;
+	priv->misc.parent = &region->dev;
+	mutex_init(&priv->ioctl_lock);
+	if (!priv->misc.name) {
+		ret = -ENOMEM;
+		goto eprobe_region_unregister;
+	}
+
+	ret = misc_register(&priv->misc);
+	if (ret)
+		goto eprobe_region_unregister;
+
 	of_platform_populate(np, fpga_region_manager_of_match, NULL, &region->dev);
 	platform_set_drvdata(pdev, region);
 
@@ -438,6 +1326,8 @@ static int fpga_region_manager_probe(struct platform_device *pdev)
 
 	return 0;
 
+eprobe_region_unregister:
+	fpga_region_core_unregister(region);
 eprobe_mgr_put:
 	fpga_mgr_put(mgr);
 	return ret;
@@ -445,10 +1335,18 @@ eprobe_mgr_put:
 
 static int fpga_region_manager_remove(struct platform_device *pdev)
 {
-	struct fpga_region_core* region = platform_get_drvdata(pdev);
-	struct fpga_manager*     mgr    = region->mgr;
+	struct fpga_region_core*          region = platform_get_drvdata(pdev);
+	struct fpga_manager*              mgr    = region->mgr;
+	struct fpga_region_manager_priv*  priv   = region->priv;
+
+	misc_deregister(&priv->misc);
+	mutex_lock(&priv->ioctl_lock);
+	fpga_region_manager_ioctl_remove(region);
+	mutex_unlock(&priv->ioctl_lock);
 
 	fpga_region_core_unregister(region);
+	fpga_region_manager_invalidate_interfaces(&priv->interfaces);
+	fpga_region_manager_invalidate_interfaces(&priv->partial_interfaces);
 	fpga_mgr_put(mgr);
 
 	return 0;
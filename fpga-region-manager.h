@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * FPGA Region Manager - character device interface
+ *
+ *  Copyright (C) 2020 Ichiro Kawazome
+ */
+
+#ifndef _UAPI_LINUX_FPGA_REGION_MANAGER_H
+#define _UAPI_LINUX_FPGA_REGION_MANAGER_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FPGA_REGION_MANAGER_FIRMWARE_NAME_MAX	256
+#define FPGA_REGION_MANAGER_INTERFACE_NAME_MAX	64
+#define FPGA_REGION_MANAGER_INTERFACES_MAX	64
+
+/* struct fpga_region_manager_program.flags */
+#define FPGA_REGION_MANAGER_PROGRAM_PARTIAL	(1 << 0)
+#define FPGA_REGION_MANAGER_PROGRAM_ENCRYPTED	(1 << 1)
+#define FPGA_REGION_MANAGER_PROGRAM_ASYNC	(1 << 2)
+#define FPGA_REGION_MANAGER_PROGRAM_STAGED	(1 << 3)
+#define FPGA_REGION_MANAGER_PROGRAM_FORCE	(1 << 4)
+
+/* struct fpga_region_manager_image.flags */
+#define FPGA_REGION_MANAGER_IMAGE_DMABUF	(1 << 0)
+
+/* struct fpga_region_manager_interface.flags */
+#define FPGA_REGION_MANAGER_INTERFACE_RATE	(1 << 0)
+#define FPGA_REGION_MANAGER_INTERFACE_ENABLE	(1 << 1)
+#define FPGA_REGION_MANAGER_INTERFACE_RESOURCE	(1 << 2)
+
+/**
+ * struct fpga_region_manager_interface - setting of one interface
+ * @name: name of the interface, as the child node name in an overlay
+ * @flags: FPGA_REGION_MANAGER_INTERFACE_* flags of the valid members
+ * @enable: as the "region-enable" property
+ * @resource: as the "region-resource" property
+ * @reserved: must be 0
+ * @rate: as the "region-rate" property
+ */
+struct fpga_region_manager_interface {
+	char  name[FPGA_REGION_MANAGER_INTERFACE_NAME_MAX];
+	__u32 flags;
+	__u32 enable;
+	__u32 resource;
+	__u32 reserved;
+	__u64 rate;
+};
+
+/**
+ * struct fpga_region_manager_program - argument of FPGA_REGION_MANAGER_IOCTL_PROGRAM
+ * @firmware_name: image file name, as the "firmware-name" property; may be
+ *                 empty with FPGA_REGION_MANAGER_PROGRAM_STAGED
+ * @flags: FPGA_REGION_MANAGER_PROGRAM_* flags
+ * @enable_timeout_us: as the "region-unfreeze-timeout-us" property
+ * @disable_timeout_us: as the "region-freeze-timeout-us" property
+ * @config_complete_timeout_us: as the "config-complete-timeout-us" property
+ * @priority: as the "region-request-priority" property (ASYNC only)
+ * @request_timeout_ms: as the "region-request-timeout-ms" property (ASYNC only)
+ * @num_interfaces: number of entries in @interfaces
+ * @reserved: must be 0
+ * @interfaces: user pointer to an array of struct fpga_region_manager_interface
+ */
+struct fpga_region_manager_program {
+	char  firmware_name[FPGA_REGION_MANAGER_FIRMWARE_NAME_MAX];
+	__u32 flags;
+	__u32 enable_timeout_us;
+	__u32 disable_timeout_us;
+	__u32 config_complete_timeout_us;
+	__s32 priority;
+	__u32 request_timeout_ms;
+	__u32 num_interfaces;
+	__u32 reserved;
+	__u64 interfaces;
+};
+
+/**
+ * struct fpga_region_manager_image - argument of FPGA_REGION_MANAGER_IOCTL_STAGE_IMAGE
+ * @flags: FPGA_REGION_MANAGER_IMAGE_* flags
+ * @dmabuf_fd: dma-buf holding the image, with FPGA_REGION_MANAGER_IMAGE_DMABUF
+ * @addr: user address of the image, without FPGA_REGION_MANAGER_IMAGE_DMABUF
+ * @size: size of the image at @addr
+ */
+struct fpga_region_manager_image {
+	__u32 flags;
+	__s32 dmabuf_fd;
+	__u64 addr;
+	__u64 size;
+};
+
+#define FPGA_REGION_MANAGER_IOCTL_MAGIC		0xB9
+
+/* Program the region, like applying an overlay with "firmware-name". */
+#define FPGA_REGION_MANAGER_IOCTL_PROGRAM \
+	_IOW(FPGA_REGION_MANAGER_IOCTL_MAGIC, 0, struct fpga_region_manager_program)
+
+/* Release the region programmed by FPGA_REGION_MANAGER_IOCTL_PROGRAM. */
+#define FPGA_REGION_MANAGER_IOCTL_REMOVE \
+	_IO(FPGA_REGION_MANAGER_IOCTL_MAGIC, 1)
+
+/*
+ * Stage an image for programs with FPGA_REGION_MANAGER_PROGRAM_STAGED and
+ * overlays with "fpga-config-from-dmabuf".  The image is used in place.
+ */
+#define FPGA_REGION_MANAGER_IOCTL_STAGE_IMAGE \
+	_IOW(FPGA_REGION_MANAGER_IOCTL_MAGIC, 2, struct fpga_region_manager_image)
+
+/* Drop the staged image. */
+#define FPGA_REGION_MANAGER_IOCTL_UNSTAGE_IMAGE \
+	_IO(FPGA_REGION_MANAGER_IOCTL_MAGIC, 3)
+
+#endif /* _UAPI_LINUX_FPGA_REGION_MANAGER_H */